@@ -0,0 +1,96 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Timing helpers shared by the benchmarks.
+
+#ifndef QUOFIL_BENCHMARKS_HARNESS_HPP
+#define QUOFIL_BENCHMARKS_HARNESS_HPP
+
+#include "perf_counters.hpp"
+
+#include <algorithm> // for std::min
+#include <chrono>    // for std::chrono::steady_clock
+#include <limits>    // for std::numeric_limits
+#include <utility>   // for std::move
+#include <vector>    // for std::vector
+#include <cstddef>   // for std::size_t
+#include <cstdint>   // for std::uint64_t
+
+namespace bench {
+
+// Keeps the compiler from discarding the computation of 'value'.
+template <typename T>
+inline void do_not_optimize(const T &value) {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  static volatile T sink;
+  sink = value;
+#endif
+}
+
+// Spreads consecutive keys over the whole range of hash values. std::hash
+// is the identity on some platforms, which would put every key in the first
+// slots of a filter.
+struct mix_hash {
+  std::size_t operator()(const std::uint64_t key) const noexcept {
+    std::uint64_t x = key + 0x9e3779b97f4a7c15;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    return static_cast<std::size_t>(x ^ (x >> 31));
+  }
+};
+
+// The result of a measured loop.
+struct measurement {
+  std::size_t ops = 0;
+  double seconds = 0;
+  std::vector<perf_counters::event> events; // Totals, if they were counted.
+
+  double ns_per_op() const noexcept {
+    return ops == 0 ? 0 : seconds * 1e9 / static_cast<double>(ops);
+  }
+  double ops_per_sec() const noexcept {
+    return seconds == 0 ? 0 : static_cast<double>(ops) / seconds;
+  }
+  double per_op(const perf_counters::event &e) const noexcept {
+    return ops == 0 ? 0 : e.count / static_cast<double>(ops);
+  }
+};
+
+// Runs 'setup()' and then times 'run()', which performs 'ops' operations,
+// 'repetitions' times. Returns the fastest repetition, which is the least
+// disturbed by the rest of the system. If 'counters' is given, its events are
+// counted around each run() as well.
+template <typename Setup, typename Run>
+measurement measure(const std::size_t ops, const unsigned repetitions,
+                    Setup setup, Run run, perf_counters *counters = nullptr) {
+  using clock = std::chrono::steady_clock;
+  measurement result;
+  result.ops = ops;
+  result.seconds = std::numeric_limits<double>::infinity();
+  for (unsigned i = 0; i != repetitions; ++i) {
+    setup();
+    if (counters)
+      counters->start();
+    const auto start = clock::now();
+    run();
+    const auto stop = clock::now();
+    std::vector<perf_counters::event> events;
+    if (counters)
+      events = counters->stop();
+
+    const double seconds = std::chrono::duration<double>(stop - start).count();
+    if (seconds < result.seconds) {
+      result.seconds = seconds;
+      result.events = std::move(events);
+    }
+  }
+  return result;
+}
+
+} // end namespace bench
+
+#endif // Header guard
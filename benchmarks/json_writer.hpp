@@ -0,0 +1,147 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Minimal streaming writer of JSON documents.
+
+#ifndef QUOFIL_BENCHMARKS_JSON_WRITER_HPP
+#define QUOFIL_BENCHMARKS_JSON_WRITER_HPP
+
+#include <ostream> // for std::ostream
+#include <string>  // for std::string
+#include <vector>  // for std::vector
+#include <cmath>   // for std::isfinite
+#include <cstddef> // for std::size_t
+#include <cstdio>  // for std::snprintf
+
+namespace bench {
+
+// Writes a JSON document to a stream as values are added. Objects and arrays
+// are opened with begin_*() and closed with end(). Inside an object, every
+// value must be preceded by key().
+class json_writer {
+public:
+  explicit json_writer(std::ostream &os_) : os(os_) {}
+
+  json_writer &begin_object() { return open('{'); }
+  json_writer &begin_array() { return open('['); }
+
+  json_writer &end() {
+    const char close = scopes.back().close;
+    const bool empty = scopes.back().empty;
+    scopes.pop_back();
+    if (!empty)
+      newline();
+    os << close;
+    if (scopes.empty())
+      os << '\n';
+    return *this;
+  }
+
+  json_writer &key(const std::string &name) {
+    separate();
+    string(name);
+    os << ": ";
+    after_key = true;
+    return *this;
+  }
+
+  json_writer &value(const std::string &text) {
+    separate();
+    string(text);
+    return *this;
+  }
+  json_writer &value(const char *text) { return value(std::string(text)); }
+
+  json_writer &value(double number) {
+    separate();
+    if (!std::isfinite(number)) {
+      os << "null";
+      return *this;
+    }
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.6g", number);
+    os << buffer;
+    return *this;
+  }
+
+  json_writer &value(unsigned long long number) {
+    separate();
+    os << number;
+    return *this;
+  }
+  json_writer &value(unsigned long number) {
+    return value(static_cast<unsigned long long>(number));
+  }
+  json_writer &value(unsigned number) {
+    return value(static_cast<unsigned long long>(number));
+  }
+
+  json_writer &value(bool flag) {
+    separate();
+    os << (flag ? "true" : "false");
+    return *this;
+  }
+
+  template <typename T>
+  json_writer &field(const std::string &name, const T &val) {
+    return key(name).value(val);
+  }
+
+private:
+  struct scope {
+    char close;
+    bool empty;
+  };
+
+  json_writer &open(char bracket) {
+    separate();
+    os << bracket;
+    scopes.push_back(scope{bracket == '{' ? '}' : ']', true});
+    return *this;
+  }
+
+  // Writes what goes before a value: nothing after a key, otherwise a comma
+  // if needed and the indentation.
+  void separate() {
+    if (after_key) {
+      after_key = false;
+      return;
+    }
+    if (scopes.empty())
+      return;
+    if (!scopes.back().empty)
+      os << ',';
+    scopes.back().empty = false;
+    newline();
+  }
+
+  void newline() {
+    os << '\n';
+    for (std::size_t i = 0; i != scopes.size(); ++i)
+      os << "  ";
+  }
+
+  void string(const std::string &text) {
+    os << '"';
+    for (const char c : text) {
+      if (c == '"' || c == '\\')
+        os << '\\' << c;
+      else if (static_cast<unsigned char>(c) < 0x20)
+        os << ' ';
+      else
+        os << c;
+    }
+    os << '"';
+  }
+
+private:
+  std::ostream &os;
+  std::vector<scope> scopes;
+  bool after_key = false;
+};
+
+} // end namespace bench
+
+#endif // Header guard
@@ -0,0 +1,113 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Histogram of latencies with bounded relative error, in the spirit of
+// HdrHistogram.
+
+#ifndef QUOFIL_BENCHMARKS_LATENCY_HISTOGRAM_HPP
+#define QUOFIL_BENCHMARKS_LATENCY_HISTOGRAM_HPP
+
+#include <algorithm> // for std::max, std::min
+#include <vector>    // for std::vector
+#include <cmath>     // for std::ceil
+#include <cstddef>   // for std::size_t
+#include <cstdint>   // for std::uint64_t
+
+namespace bench {
+
+// Records non-negative integer values, e.g. nanoseconds. Values below
+// 2^precision_bits are counted exactly. Greater values share buckets whose
+// width is at most 1 / 2^precision_bits of the values they hold, so each
+// octave has the same number of buckets.
+class latency_histogram {
+public:
+  static constexpr unsigned precision_bits = 7;
+
+  latency_histogram() : counts(num_buckets) {}
+
+  void record(const std::uint64_t value) noexcept {
+    ++counts[bucket_of(value)];
+    ++total;
+    sum += value;
+    max_value = std::max(max_value, value);
+    min_value = std::min(min_value, value);
+  }
+
+  std::uint64_t count() const noexcept { return total; }
+  std::uint64_t max() const noexcept { return max_value; }
+  std::uint64_t min() const noexcept { return total == 0 ? 0 : min_value; }
+
+  double mean() const noexcept {
+    return total == 0 ? 0
+                      : static_cast<double>(sum) / static_cast<double>(total);
+  }
+
+  // Returns the least value v such that 'percent' percent of the recorded
+  // values are at most v, up to the precision of the buckets. The highest
+  // value of the bucket is returned, but never more than max().
+  std::uint64_t percentile(const double percent) const noexcept {
+    if (total == 0)
+      return 0;
+    const double rank = std::ceil(percent / 100 * static_cast<double>(total));
+    const auto target =
+        std::max<std::uint64_t>(1, static_cast<std::uint64_t>(rank));
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i != num_buckets; ++i) {
+      seen += counts[i];
+      if (seen >= target)
+        return std::min(highest_in_bucket(i), max_value);
+    }
+    return max_value;
+  }
+
+  // Adds the values recorded by another histogram.
+  void merge(const latency_histogram &other) noexcept {
+    for (std::size_t i = 0; i != num_buckets; ++i)
+      counts[i] += other.counts[i];
+    total += other.total;
+    sum += other.sum;
+    max_value = std::max(max_value, other.max_value);
+    min_value = std::min(min_value, other.min_value);
+  }
+
+private:
+  static constexpr std::uint64_t sub_buckets = std::uint64_t{1}
+                                               << precision_bits;
+  static constexpr std::size_t num_buckets =
+      (64 - precision_bits + 1) * sub_buckets;
+
+  // Values in [0, sub_buckets) have a bucket each. A greater value whose most
+  // significant bit is b is shifted right by e = b - precision_bits bits,
+  // which leaves a mantissa m in [sub_buckets, 2 * sub_buckets). Its bucket
+  // is e * sub_buckets + m.
+  static std::size_t bucket_of(const std::uint64_t value) noexcept {
+    if (value < sub_buckets)
+      return static_cast<std::size_t>(value);
+    unsigned msb = 63;
+    while ((value >> msb) == 0)
+      --msb;
+    const unsigned shift = msb - precision_bits;
+    return static_cast<std::size_t>(shift * sub_buckets + (value >> shift));
+  }
+
+  static std::uint64_t highest_in_bucket(const std::size_t i) noexcept {
+    if (i < sub_buckets)
+      return i;
+    const auto shift = static_cast<unsigned>(i / sub_buckets - 1);
+    const std::uint64_t mantissa = i - shift * sub_buckets;
+    return ((mantissa + 1) << shift) - 1;
+  }
+
+private:
+  std::vector<std::uint64_t> counts;
+  std::uint64_t total = 0;
+  std::uint64_t sum = 0;
+  std::uint64_t max_value = 0;
+  std::uint64_t min_value = ~std::uint64_t{0};
+};
+
+} // end namespace bench
+
+#endif // Header guard
@@ -0,0 +1,121 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Hardware performance counters read with Linux perf_event_open.
+
+#ifndef QUOFIL_BENCHMARKS_PERF_COUNTERS_HPP
+#define QUOFIL_BENCHMARKS_PERF_COUNTERS_HPP
+
+#include <string>  // for std::string
+#include <vector>  // for std::vector
+#include <cstdint> // for std::uint64_t
+
+#ifdef __linux__
+#include <linux/perf_event.h> // for perf_event_attr, PERF_*
+#include <sys/ioctl.h>        // for ::ioctl
+#include <sys/syscall.h>      // for SYS_perf_event_open
+#include <unistd.h>           // for ::syscall, ::read, ::close
+#endif
+
+namespace bench {
+
+// Counts hardware events of the calling thread between start() and stop().
+// Each event has its own counter, so the events which the machine (or the
+// virtual machine) does not support are just left out. When the kernel
+// multiplexes the counters, the counts are scaled to the whole interval.
+class perf_counters {
+public:
+  struct event {
+    std::string name;
+    double count;
+  };
+
+  perf_counters() {
+#ifdef __linux__
+    constexpr std::uint32_t hw = PERF_TYPE_HARDWARE;
+    constexpr std::uint32_t cache = PERF_TYPE_HW_CACHE;
+    constexpr std::uint64_t read_miss =
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    add("cycles", hw, PERF_COUNT_HW_CPU_CYCLES);
+    add("instructions", hw, PERF_COUNT_HW_INSTRUCTIONS);
+    add("l1d_misses", cache, PERF_COUNT_HW_CACHE_L1D | read_miss);
+    add("llc_misses", cache, PERF_COUNT_HW_CACHE_LL | read_miss);
+    add("branch_misses", hw, PERF_COUNT_HW_BRANCH_MISSES);
+#endif
+  }
+
+  perf_counters(const perf_counters &) = delete;
+  perf_counters &operator=(const perf_counters &) = delete;
+
+  ~perf_counters() {
+#ifdef __linux__
+    for (const auto &c : counters)
+      ::close(c.fd);
+#endif
+  }
+
+  // Checks whether any event can be counted.
+  bool available() const noexcept { return !counters.empty(); }
+
+  void start() noexcept {
+#ifdef __linux__
+    for (const auto &c : counters) {
+      ::ioctl(c.fd, PERF_EVENT_IOC_RESET, 0);
+      ::ioctl(c.fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+  }
+
+  // Returns the events counted since start().
+  std::vector<event> stop() {
+    std::vector<event> events;
+#ifdef __linux__
+    for (const auto &c : counters)
+      ::ioctl(c.fd, PERF_EVENT_IOC_DISABLE, 0);
+    for (const auto &c : counters) {
+      // Value, time enabled and time running.
+      std::uint64_t data[3] = {0, 0, 0};
+      if (::read(c.fd, data, sizeof(data)) != sizeof(data))
+        continue;
+      const double scale =
+          data[2] == 0
+              ? 0
+              : static_cast<double>(data[1]) / static_cast<double>(data[2]);
+      events.push_back(event{c.name, static_cast<double>(data[0]) * scale});
+    }
+#endif
+    return events;
+  }
+
+private:
+#ifdef __linux__
+  void add(const char *name, std::uint32_t type, std::uint64_t config) {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    const long fd = ::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd >= 0)
+      counters.push_back(counter{name, static_cast<int>(fd)});
+  }
+#endif
+
+private:
+  struct counter {
+    std::string name;
+    int fd;
+  };
+  std::vector<counter> counters;
+};
+
+} // end namespace bench
+
+#endif // Header guard
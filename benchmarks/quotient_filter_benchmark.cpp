@@ -0,0 +1,389 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Micro-benchmarks of quotient_filter_fp.
+//
+// For every combination of quotient bits, remainder bits and load factor, the
+// filter is filled up to the load factor and the following operations are
+// timed:
+//
+//   insert        Inserts the last 5% of the elements (or fewer).
+//   erase         Erases them again.
+//   lookup_hit    Searches fingerprints which are in the filter.
+//   lookup_miss   Searches fingerprints which are not in the filter.
+//   iterate       Visits every element in order.
+//   regenerate    Doubles the slots with expand(), as the filters do when
+//                 they grow. Reported per element.
+//
+// Usage: quotient_filter_benchmark [options]
+//
+//   --q=16,20         Quotient bits to sweep.
+//   --r=8,16          Remainder bits to sweep.
+//   --load=0.1,0.5    Load factors to sweep, in (0, 1].
+//   --layout=separate Slot layout: separate, blocked or both.
+//   --repetitions=3   Times each loop runs. The fastest one is reported.
+//   --seed=N          Seed of the fingerprint generator.
+//   --quick           Small sweep, useful as a smoke test.
+//   --perf            Counts hardware events (cycles, instructions, L1 data
+//                     and last level cache misses, branch misses) of each
+//                     loop and reports them per operation. Linux only.
+//   --json            Writes JSON to the standard output instead of a table.
+
+#include <quofil/quotient_filter_fp.hpp>
+#include "harness.hpp"
+#include "json_writer.hpp"
+
+#include <algorithm> // for std::{sort, unique, shuffle, binary_search, min}
+#include <iomanip>   // for std::setw, std::setprecision
+#include <iostream>  // for std::cout, std::cerr
+#include <random>    // for std::mt19937_64
+#include <sstream>   // for std::istringstream
+#include <stdexcept> // for std::invalid_argument
+#include <string>    // for std::string
+#include <vector>    // for std::vector
+#include <cmath>     // for std::ceil
+#include <cstddef>   // for std::size_t
+
+// ==========================================
+// General declarations.
+// ==========================================
+
+using quofil::quotient_filter_fp;
+using quofil::slot_layout;
+using value_type = quotient_filter_fp::value_type;
+using std::size_t;
+
+namespace {
+
+struct options {
+  std::vector<size_t> q_bits = {16, 20};
+  std::vector<size_t> r_bits = {8, 16};
+  std::vector<double> loads = {0.10, 0.25, 0.50, 0.75, 0.85, 0.90, 0.95};
+  std::vector<slot_layout> layouts = {slot_layout::separate};
+  unsigned repetitions = 3;
+  unsigned long seed = 20150601;
+  bool perf = false;
+  bool json = false;
+};
+
+struct result {
+  std::string operation;
+  size_t q_bits;
+  size_t r_bits;
+  slot_layout layout;
+  double load_factor;
+  bench::measurement time;
+};
+
+} // end anonymous namespace
+
+static const char *layout_name(const slot_layout layout) {
+  return layout == slot_layout::separate ? "separate" : "blocked";
+}
+
+// ==========================================
+// Command line
+// ==========================================
+
+template <typename T>
+static std::vector<T> parse_list(const std::string &text) {
+  std::vector<T> values;
+  std::istringstream is(text);
+  std::string item;
+  while (std::getline(is, item, ',')) {
+    std::istringstream item_is(item);
+    T value;
+    if (!(item_is >> value))
+      throw std::invalid_argument("Invalid list: " + text);
+    values.push_back(value);
+  }
+  return values;
+}
+
+static options parse_options(const int argc, char **const argv) {
+  options opts;
+  for (int i = 1; i != argc; ++i) {
+    const std::string arg = argv[i];
+    const auto eq = arg.find('=');
+    const std::string name = arg.substr(0, eq);
+    const std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+    if (name == "--q")
+      opts.q_bits = parse_list<size_t>(value);
+    else if (name == "--r")
+      opts.r_bits = parse_list<size_t>(value);
+    else if (name == "--load")
+      opts.loads = parse_list<double>(value);
+    else if (name == "--layout" && value == "separate")
+      opts.layouts = {slot_layout::separate};
+    else if (name == "--layout" && value == "blocked")
+      opts.layouts = {slot_layout::blocked};
+    else if (name == "--layout" && value == "both")
+      opts.layouts = {slot_layout::separate, slot_layout::blocked};
+    else if (name == "--repetitions")
+      opts.repetitions = std::max(1u, parse_list<unsigned>(value).at(0));
+    else if (name == "--seed")
+      opts.seed = parse_list<unsigned long>(value).at(0);
+    else if (name == "--quick") {
+      opts.q_bits = {12};
+      opts.r_bits = {8};
+      opts.loads = {0.5, 0.9};
+      opts.repetitions = 1;
+    } else if (name == "--perf")
+      opts.perf = true;
+    else if (name == "--json")
+      opts.json = true;
+    else
+      throw std::invalid_argument("Unknown option: " + arg);
+  }
+
+  for (const double load : opts.loads)
+    if (!(load > 0 && load <= 1))
+      throw std::invalid_argument("Load factors must be in (0, 1]");
+  for (const size_t q : opts.q_bits)
+    for (const size_t r : opts.r_bits)
+      if (r == 0 || q + r > 64 || q > 30)
+        throw std::invalid_argument("Unsupported quotient or remainder bits");
+  std::sort(opts.loads.begin(), opts.loads.end());
+  return opts;
+}
+
+// ==========================================
+// Fingerprints
+// ==========================================
+
+// Returns 'count' distinct random fingerprints of 'bits' bits, in random
+// order.
+static std::vector<value_type> distinct_fingerprints(const size_t count,
+                                                     const size_t bits,
+                                                     std::mt19937_64 &gen) {
+  const value_type mask =
+      bits == 64 ? ~value_type{0} : (value_type{1} << bits) - 1;
+  std::vector<value_type> fps;
+  while (fps.size() < count) {
+    while (fps.size() < count + count / 8 + 16)
+      fps.push_back(gen() & mask);
+    std::sort(fps.begin(), fps.end());
+    fps.erase(std::unique(fps.begin(), fps.end()), fps.end());
+  }
+  std::shuffle(fps.begin(), fps.end(), gen);
+  fps.resize(count);
+  return fps;
+}
+
+// Returns 'count' random fingerprints of 'bits' bits which are not in the
+// sorted range 'present'.
+static std::vector<value_type>
+absent_fingerprints(const size_t count, const size_t bits,
+                    const std::vector<value_type> &present,
+                    std::mt19937_64 &gen) {
+  const value_type mask =
+      bits == 64 ? ~value_type{0} : (value_type{1} << bits) - 1;
+  std::vector<value_type> fps;
+  fps.reserve(count);
+  while (fps.size() < count) {
+    const value_type fp = gen() & mask;
+    if (!std::binary_search(present.begin(), present.end(), fp))
+      fps.push_back(fp);
+  }
+  return fps;
+}
+
+// ==========================================
+// Benchmarks
+// ==========================================
+
+static void run_sweep(const options &opts, const size_t q, const size_t r,
+                      const slot_layout layout, bench::perf_counters *counters,
+                      std::vector<result> &results) {
+  const size_t capacity = size_t{1} << q;
+  const size_t max_count =
+      static_cast<size_t>(opts.loads.back() * static_cast<double>(capacity));
+  constexpr size_t max_lookups = size_t{1} << 20;
+
+  std::mt19937_64 gen(opts.seed + q * 64 + r);
+  const auto keys = distinct_fingerprints(max_count, q + r, gen);
+  std::vector<value_type> sorted_keys = keys;
+  std::sort(sorted_keys.begin(), sorted_keys.end());
+  const auto misses =
+      absent_fingerprints(std::min(max_count, max_lookups) + 1, q + r,
+                          sorted_keys, gen);
+  std::vector<value_type>().swap(sorted_keys);
+
+  quotient_filter_fp filter(q, r, layout);
+  size_t filled = 0; // keys[0, filled) are in the filter.
+
+  const auto insert_range = [&](size_t first, size_t last) {
+    for (size_t i = first; i != last; ++i)
+      filter.insert(keys[i]);
+  };
+  const auto erase_range = [&](size_t first, size_t last) {
+    for (size_t i = first; i != last; ++i)
+      filter.erase(keys[i]);
+  };
+
+  for (const double load : opts.loads) {
+    const auto target =
+        static_cast<size_t>(load * static_cast<double>(capacity));
+    if (target == 0 || target < filled)
+      continue;
+    const size_t batch = std::max<size_t>(
+        1, std::min(target - filled, std::min(target, capacity / 20)));
+    const size_t batch_begin = target - batch;
+    insert_range(filled, batch_begin);
+
+    const auto add = [&](const char *operation, bench::measurement time) {
+      results.push_back(result{operation, q, r, layout, load, time});
+    };
+
+    // The batch is out of the filter before each insertion and in it before
+    // each erasure.
+    add("insert", bench::measure(
+                      batch, opts.repetitions,
+                      [&] {
+                        if (filter.size() == target)
+                          erase_range(batch_begin, target);
+                      },
+                      [&] { insert_range(batch_begin, target); }, counters));
+    add("erase", bench::measure(
+                     batch, opts.repetitions,
+                     [&] {
+                       if (filter.size() != target)
+                         insert_range(batch_begin, target);
+                     },
+                     [&] { erase_range(batch_begin, target); }, counters));
+    insert_range(batch_begin, target);
+    filled = target;
+
+    const size_t lookups = std::min(target, max_lookups);
+    add("lookup_hit", bench::measure(lookups, opts.repetitions, [] {}, [&] {
+          size_t found = 0;
+          for (size_t i = 0; i != lookups; ++i)
+            found += filter.count(keys[i]);
+          bench::do_not_optimize(found);
+        }, counters));
+    add("lookup_miss", bench::measure(lookups, opts.repetitions, [] {}, [&] {
+          size_t found = 0;
+          for (size_t i = 0; i != lookups; ++i)
+            found += filter.count(misses[i]);
+          bench::do_not_optimize(found);
+        }, counters));
+    add("iterate", bench::measure(filter.size(), opts.repetitions, [] {}, [&] {
+          value_type sum = 0;
+          for (const value_type fp : filter)
+            sum += fp;
+          bench::do_not_optimize(sum);
+        }, counters));
+
+    if (r > 1) {
+      quotient_filter_fp copy;
+      add("regenerate",
+          bench::measure(filter.size(), opts.repetitions,
+                         [&] { copy = filter; }, [&] { copy.expand(); },
+                         counters));
+    }
+  }
+}
+
+// ==========================================
+// Output
+// ==========================================
+
+static void print_table(const std::vector<result> &results) {
+  std::cout << std::left << std::setw(12) << "operation" << std::right
+            << std::setw(4) << "q" << std::setw(4) << "r" << std::setw(10)
+            << "layout" << std::setw(7) << "load" << std::setw(12) << "ops"
+            << std::setw(11) << "ns/op" << std::setw(11) << "Mops/s";
+  // The events are per operation, under the header of the first result.
+  if (!results.empty())
+    for (const auto &e : results.front().time.events)
+      std::cout << std::setw(15) << e.name;
+  std::cout << '\n';
+
+  for (const auto &res : results) {
+    std::cout << std::left << std::setw(12) << res.operation << std::right
+              << std::setw(4) << res.q_bits << std::setw(4) << res.r_bits
+              << std::setw(10) << layout_name(res.layout) << std::fixed
+              << std::setprecision(2) << std::setw(7) << res.load_factor
+              << std::setw(12) << res.time.ops << std::setw(11)
+              << res.time.ns_per_op() << std::setw(11)
+              << res.time.ops_per_sec() / 1e6;
+    for (const auto &e : res.time.events)
+      std::cout << std::setw(15) << res.time.per_op(e);
+    std::cout << '\n';
+  }
+}
+
+static void print_json(const options &opts,
+                       const std::vector<result> &results) {
+  bench::json_writer json(std::cout);
+  json.begin_object();
+  json.field("benchmark", "quotient_filter_fp");
+  json.key("config").begin_object();
+  json.field("repetitions", opts.repetitions);
+  json.field("seed", opts.seed);
+  json.field("perf_counters", opts.perf);
+#ifdef NDEBUG
+  json.field("assertions", false);
+#else
+  json.field("assertions", true);
+#endif
+  json.end();
+
+  json.key("results").begin_array();
+  for (const auto &res : results) {
+    json.begin_object();
+    json.field("operation", res.operation);
+    json.field("q_bits", res.q_bits);
+    json.field("r_bits", res.r_bits);
+    json.field("layout", layout_name(res.layout));
+    json.field("load_factor", res.load_factor);
+    json.field("ops", res.time.ops);
+    json.field("seconds", res.time.seconds);
+    json.field("ns_per_op", res.time.ns_per_op());
+    json.field("ops_per_sec", res.time.ops_per_sec());
+    if (!res.time.events.empty()) {
+      json.key("counters_per_op").begin_object();
+      for (const auto &e : res.time.events)
+        json.field(e.name, res.time.per_op(e));
+      json.end();
+    }
+    json.end();
+  }
+  json.end();
+  json.end();
+}
+
+int main(int argc, char **argv) {
+  options opts;
+  try {
+    opts = parse_options(argc, argv);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << '\n';
+    return 2;
+  }
+
+#ifndef NDEBUG
+  std::cerr << "Warning: assertions are enabled, build with "
+               "CMAKE_BUILD_TYPE=Release for meaningful timings.\n";
+#endif
+
+  bench::perf_counters counters;
+  if (opts.perf && !counters.available())
+    std::cerr << "Warning: no hardware counter could be opened, check "
+                 "/proc/sys/kernel/perf_event_paranoid.\n";
+  bench::perf_counters *const used_counters = opts.perf ? &counters : nullptr;
+
+  std::vector<result> results;
+  for (const slot_layout layout : opts.layouts)
+    for (const size_t q : opts.q_bits)
+      for (const size_t r : opts.r_bits)
+        run_sweep(opts, q, r, layout, used_counters, results);
+
+  if (opts.json)
+    print_json(opts, results);
+  else
+    print_table(results);
+}
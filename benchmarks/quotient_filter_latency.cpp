@@ -0,0 +1,361 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Latency distribution of quotient_filter under mixed workloads.
+//
+// Runs a random sequence of lookups, insertions and erasures and times every
+// operation on its own, so the stalls caused by regenerations show up in the
+// tail of the insertions instead of being averaged away. The keys are drawn
+// from a universe of consecutive integers, either uniformly or following a
+// Zipfian distribution.
+//
+// Usage: quotient_filter_latency [options]
+//
+//   --mix=90/9/1      Percentages of lookups, insertions and erasures.
+//   --dist=uniform    Key distribution: uniform or zipf.
+//   --theta=0.99      Skew of the Zipfian distribution, in (0, 1).
+//   --keys=1000000    Size of the key universe.
+//   --ops=2000000     Number of timed operations.
+//   --prefill=0.5     Fraction of the universe inserted before timing.
+//   --max-load=0.75   max_load_factor() of the filter.
+//   --seed=N          Seed of the workload generator.
+//   --quick           Small run, useful as a smoke test.
+//   --perf            Counts hardware events during the timed operations and
+//                     reports them per operation, clock readings included.
+//                     Linux only.
+//   --json            Writes JSON to the standard output instead of a table.
+//
+// Latencies are reported in nanoseconds. They include the overhead of reading
+// the clock, which is reported too.
+
+#include <quofil/quotient_filter.hpp>
+#include "harness.hpp"
+#include "json_writer.hpp"
+#include "latency_histogram.hpp"
+#include "zipf_distribution.hpp"
+
+#include <algorithm> // for std::min
+#include <chrono>    // for std::chrono::steady_clock
+#include <iomanip>   // for std::setw
+#include <iostream>  // for std::cout, std::cerr
+#include <random>    // for std::mt19937_64, std::uniform_int_distribution
+#include <sstream>   // for std::istringstream
+#include <stdexcept> // for std::invalid_argument
+#include <string>    // for std::string
+#include <vector>    // for std::vector
+#include <cstddef>   // for std::size_t
+#include <cstdint>   // for std::uint64_t
+
+// ==========================================
+// General declarations.
+// ==========================================
+
+using std::size_t;
+using std::uint64_t;
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+
+using filter_t = quofil::quotient_filter<uint64_t, bench::mix_hash>;
+
+enum operation { lookup_op, insert_op, erase_op, num_operations };
+
+const char *const operation_names[num_operations] = {"lookup", "insert",
+                                                     "erase"};
+
+struct options {
+  unsigned mix[num_operations] = {90, 9, 1};
+  bool zipf = false;
+  double theta = 0.99;
+  uint64_t keys = 1000000;
+  uint64_t ops = 2000000;
+  double prefill = 0.5;
+  float max_load = 0.75f;
+  unsigned long seed = 20150601;
+  bool perf = false;
+  bool json = false;
+};
+
+struct report {
+  bench::latency_histogram latencies[num_operations];
+  bench::latency_histogram all;
+  bench::latency_histogram growths; // Insertions which regenerated.
+  uint64_t timer_overhead = 0;
+  size_t final_size = 0;
+  size_t final_slot_count = 0;
+  std::vector<bench::perf_counters::event> events; // Totals, if counted.
+};
+
+} // end anonymous namespace
+
+// ==========================================
+// Command line
+// ==========================================
+
+template <typename T>
+static T parse_value(const std::string &text) {
+  std::istringstream is(text);
+  T value;
+  if (!(is >> value) || !is.eof())
+    throw std::invalid_argument("Invalid value: " + text);
+  return value;
+}
+
+static void parse_mix(const std::string &text,
+                      unsigned (&mix)[num_operations]) {
+  std::istringstream is(text);
+  std::string item;
+  unsigned total = 0;
+  for (unsigned &percent : mix) {
+    if (!std::getline(is, item, '/'))
+      throw std::invalid_argument("The mix needs three percentages: " + text);
+    percent = parse_value<unsigned>(item);
+    total += percent;
+  }
+  if (total != 100)
+    throw std::invalid_argument("The mix must add up to 100: " + text);
+}
+
+static options parse_options(const int argc, char **const argv) {
+  options opts;
+  for (int i = 1; i != argc; ++i) {
+    const std::string arg = argv[i];
+    const auto eq = arg.find('=');
+    const std::string name = arg.substr(0, eq);
+    const std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+    if (name == "--mix")
+      parse_mix(value, opts.mix);
+    else if (name == "--dist" && (value == "uniform" || value == "zipf"))
+      opts.zipf = value == "zipf";
+    else if (name == "--theta")
+      opts.theta = parse_value<double>(value);
+    else if (name == "--keys")
+      opts.keys = parse_value<uint64_t>(value);
+    else if (name == "--ops")
+      opts.ops = parse_value<uint64_t>(value);
+    else if (name == "--prefill")
+      opts.prefill = parse_value<double>(value);
+    else if (name == "--max-load")
+      opts.max_load = parse_value<float>(value);
+    else if (name == "--seed")
+      opts.seed = parse_value<unsigned long>(value);
+    else if (name == "--quick") {
+      opts.keys = 20000;
+      opts.ops = 50000;
+    } else if (name == "--perf")
+      opts.perf = true;
+    else if (name == "--json")
+      opts.json = true;
+    else
+      throw std::invalid_argument("Unknown option: " + arg);
+  }
+
+  if (opts.keys < 2)
+    throw std::invalid_argument("The universe needs at least two keys");
+  if (!(opts.theta > 0 && opts.theta < 1))
+    throw std::invalid_argument("theta must be in (0, 1)");
+  if (!(opts.prefill >= 0 && opts.prefill <= 1))
+    throw std::invalid_argument("prefill must be in [0, 1]");
+  return opts;
+}
+
+// ==========================================
+// Workload
+// ==========================================
+
+// Returns the least time between two consecutive readings of the clock.
+static uint64_t timer_overhead() {
+  auto best = clock_type::duration::max();
+  for (int i = 0; i != 10000; ++i) {
+    const auto start = clock_type::now();
+    const auto stop = clock_type::now();
+    best = std::min(best, stop - start);
+  }
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(best).count());
+}
+
+static report run_workload(const options &opts) {
+  std::mt19937_64 gen(opts.seed);
+  std::uniform_int_distribution<uint64_t> uniform_key(0, opts.keys - 1);
+  std::uniform_int_distribution<unsigned> percent(0, 99);
+  bench::zipf_distribution zipf_key(opts.keys, opts.theta);
+  const auto next_key = [&] {
+    return opts.zipf ? zipf_key(gen) : uniform_key(gen);
+  };
+
+  // The filter grows from its default size, as in a service which starts
+  // empty.
+  filter_t filter;
+  filter.max_load_factor(opts.max_load);
+  const auto prefill = static_cast<uint64_t>(
+      opts.prefill * static_cast<double>(opts.keys));
+  for (uint64_t key = 0; key != prefill; ++key)
+    filter.insert(key);
+
+  report rep;
+  rep.timer_overhead = timer_overhead();
+  bench::perf_counters counters;
+  if (opts.perf && !counters.available())
+    std::cerr << "Warning: no hardware counter could be opened, check "
+                 "/proc/sys/kernel/perf_event_paranoid.\n";
+  if (opts.perf)
+    counters.start();
+
+  size_t found = 0;
+  for (uint64_t i = 0; i != opts.ops; ++i) {
+    const unsigned dice = percent(gen);
+    const auto op = dice < opts.mix[lookup_op]
+                        ? lookup_op
+                        : dice < opts.mix[lookup_op] + opts.mix[insert_op]
+                              ? insert_op
+                              : erase_op;
+    const uint64_t key = next_key();
+    const size_t slots_before = filter.slot_count();
+
+    const auto start = clock_type::now();
+    switch (op) {
+    case lookup_op:
+      found += filter.count(key);
+      break;
+    case insert_op:
+      found += filter.insert(key).second;
+      break;
+    default:
+      found += filter.erase(key);
+      break;
+    }
+    const auto stop = clock_type::now();
+
+    const auto ns = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start)
+            .count());
+    rep.latencies[op].record(ns);
+    rep.all.record(ns);
+    if (filter.slot_count() != slots_before)
+      rep.growths.record(ns);
+  }
+  bench::do_not_optimize(found);
+  if (opts.perf)
+    rep.events = counters.stop();
+
+  rep.final_size = filter.size();
+  rep.final_slot_count = filter.slot_count();
+  return rep;
+}
+
+// ==========================================
+// Output
+// ==========================================
+
+static const double reported_percentiles[] = {50, 90, 99, 99.9, 99.99};
+
+static void print_table(const report &rep) {
+  const auto row = [](const char *name, const bench::latency_histogram &h) {
+    std::cout << std::left << std::setw(10) << name << std::right
+              << std::setw(10) << h.count() << std::setw(10)
+              << static_cast<uint64_t>(h.mean());
+    for (const double p : reported_percentiles)
+      std::cout << std::setw(10) << h.percentile(p);
+    std::cout << std::setw(12) << h.max() << '\n';
+  };
+
+  std::cout << std::left << std::setw(10) << "operation" << std::right
+            << std::setw(10) << "count" << std::setw(10) << "mean"
+            << std::setw(10) << "p50" << std::setw(10) << "p90"
+            << std::setw(10) << "p99" << std::setw(10) << "p99.9"
+            << std::setw(10) << "p99.99" << std::setw(12) << "max" << '\n';
+  for (int op = 0; op != num_operations; ++op)
+    row(operation_names[op], rep.latencies[op]);
+  row("all", rep.all);
+  row("growth", rep.growths);
+  std::cout << "\nLatencies in ns. Clock overhead: " << rep.timer_overhead
+            << " ns. Final size: " << rep.final_size
+            << ", slots: " << rep.final_slot_count << ".\n";
+  for (const auto &e : rep.events)
+    std::cout << e.name << " per operation: "
+              << e.count / static_cast<double>(rep.all.count()) << '\n';
+}
+
+static void write_histogram(bench::json_writer &json, const char *name,
+                            const bench::latency_histogram &h) {
+  json.begin_object();
+  json.field("operation", name);
+  json.field("count", h.count());
+  json.field("mean_ns", h.mean());
+  json.field("min_ns", h.min());
+  json.field("p50_ns", h.percentile(50));
+  json.field("p90_ns", h.percentile(90));
+  json.field("p99_ns", h.percentile(99));
+  json.field("p99_9_ns", h.percentile(99.9));
+  json.field("p99_99_ns", h.percentile(99.99));
+  json.field("max_ns", h.max());
+  json.end();
+}
+
+static void print_json(const options &opts, const report &rep) {
+  bench::json_writer json(std::cout);
+  json.begin_object();
+  json.field("benchmark", "quotient_filter_latency");
+  json.key("config").begin_object();
+  json.key("mix").begin_object();
+  for (int op = 0; op != num_operations; ++op)
+    json.field(operation_names[op], opts.mix[op]);
+  json.end();
+  json.field("distribution", opts.zipf ? "zipf" : "uniform");
+  if (opts.zipf)
+    json.field("theta", opts.theta);
+  json.field("keys", opts.keys);
+  json.field("ops", opts.ops);
+  json.field("prefill", opts.prefill);
+  json.field("max_load_factor", static_cast<double>(opts.max_load));
+  json.field("seed", opts.seed);
+  json.field("perf_counters", opts.perf);
+#ifdef NDEBUG
+  json.field("assertions", false);
+#else
+  json.field("assertions", true);
+#endif
+  json.end();
+
+  json.field("timer_overhead_ns", rep.timer_overhead);
+  json.field("final_size", rep.final_size);
+  json.field("final_slot_count", rep.final_slot_count);
+  if (!rep.events.empty()) {
+    json.key("counters_per_op").begin_object();
+    for (const auto &e : rep.events)
+      json.field(e.name, e.count / static_cast<double>(rep.all.count()));
+    json.end();
+  }
+  json.key("latencies").begin_array();
+  for (int op = 0; op != num_operations; ++op)
+    write_histogram(json, operation_names[op], rep.latencies[op]);
+  write_histogram(json, "all", rep.all);
+  write_histogram(json, "growth", rep.growths);
+  json.end();
+  json.end();
+}
+
+int main(int argc, char **argv) {
+  options opts;
+  try {
+    opts = parse_options(argc, argv);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << '\n';
+    return 2;
+  }
+
+#ifndef NDEBUG
+  std::cerr << "Warning: assertions are enabled, build with "
+               "CMAKE_BUILD_TYPE=Release for meaningful timings.\n";
+#endif
+
+  const report rep = run_workload(opts);
+  if (opts.json)
+    print_json(opts, rep);
+  else
+    print_table(rep);
+}
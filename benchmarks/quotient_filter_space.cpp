@@ -0,0 +1,287 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Space against false-positive rate of quotient_filter_fp.
+//
+// For every combination of quotient bits, remainder bits and load factor, the
+// filter is built with the hashes of consecutive keys and queried with keys
+// which were not inserted. Every positive answer is a false positive. The
+// table shows the memory used, as given by memory_usage(), next to the
+// observed false-positive rate and the expected one, which is
+// 1 - exp(-n / 2^(q + r)) for n inserted keys. The shape of the slots, as given
+// by statistics(), shows what each load factor costs to the lookups and the
+// insertions: the length of the clusters and how far the elements are shifted.
+//
+// Usage: quotient_filter_space [options]
+//
+//   --q=20            Quotient bits to sweep.
+//   --r=4,6,8,...     Remainder bits to sweep.
+//   --load=0.5,0.75   Load factors to sweep, in (0, 1].
+//   --layout=separate Slot layout: separate, blocked or both.
+//   --queries=N       Number of keys queried for each filter.
+//   --quick           Small sweep, useful as a smoke test.
+//   --json            Writes JSON to the standard output instead of a table.
+
+#include <quofil/quotient_filter_fp.hpp>
+#include "harness.hpp"
+#include "json_writer.hpp"
+
+#include <iomanip>   // for std::setw, std::setprecision
+#include <iostream>  // for std::cout, std::cerr
+#include <sstream>   // for std::istringstream
+#include <stdexcept> // for std::invalid_argument
+#include <string>    // for std::string
+#include <vector>    // for std::vector
+#include <cmath>     // for std::exp, std::ldexp
+#include <cstddef>   // for std::size_t
+#include <cstdint>   // for std::uint64_t
+
+// ==========================================
+// General declarations.
+// ==========================================
+
+using quofil::quotient_filter_fp;
+using quofil::slot_layout;
+using value_type = quotient_filter_fp::value_type;
+using std::size_t;
+using std::uint64_t;
+
+namespace {
+
+struct options {
+  std::vector<size_t> q_bits = {20};
+  std::vector<size_t> r_bits = {4, 6, 8, 10, 12, 16};
+  std::vector<double> loads = {0.50, 0.75, 0.90};
+  std::vector<slot_layout> layouts = {slot_layout::separate};
+  uint64_t queries = 1000000;
+  bool json = false;
+};
+
+struct result {
+  size_t q_bits;
+  size_t r_bits;
+  slot_layout layout;
+  double load_factor;
+  size_t size;
+  quofil::memory_footprint memory;
+  double bits_per_element;
+  double observed_fpr;
+  double expected_fpr;
+  quofil::filter_statistics stats;
+};
+
+} // end anonymous namespace
+
+static const char *layout_name(const slot_layout layout) {
+  return layout == slot_layout::separate ? "separate" : "blocked";
+}
+
+// ==========================================
+// Command line
+// ==========================================
+
+template <typename T>
+static std::vector<T> parse_list(const std::string &text) {
+  std::vector<T> values;
+  std::istringstream is(text);
+  std::string item;
+  while (std::getline(is, item, ',')) {
+    std::istringstream item_is(item);
+    T value;
+    if (!(item_is >> value))
+      throw std::invalid_argument("Invalid list: " + text);
+    values.push_back(value);
+  }
+  return values;
+}
+
+static options parse_options(const int argc, char **const argv) {
+  options opts;
+  for (int i = 1; i != argc; ++i) {
+    const std::string arg = argv[i];
+    const auto eq = arg.find('=');
+    const std::string name = arg.substr(0, eq);
+    const std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+    if (name == "--q")
+      opts.q_bits = parse_list<size_t>(value);
+    else if (name == "--r")
+      opts.r_bits = parse_list<size_t>(value);
+    else if (name == "--load")
+      opts.loads = parse_list<double>(value);
+    else if (name == "--layout" && value == "separate")
+      opts.layouts = {slot_layout::separate};
+    else if (name == "--layout" && value == "blocked")
+      opts.layouts = {slot_layout::blocked};
+    else if (name == "--layout" && value == "both")
+      opts.layouts = {slot_layout::separate, slot_layout::blocked};
+    else if (name == "--queries")
+      opts.queries = parse_list<uint64_t>(value).at(0);
+    else if (name == "--quick") {
+      opts.q_bits = {12};
+      opts.r_bits = {4, 8};
+      opts.loads = {0.75};
+      opts.queries = 100000;
+    } else if (name == "--json")
+      opts.json = true;
+    else
+      throw std::invalid_argument("Unknown option: " + arg);
+  }
+
+  for (const double load : opts.loads)
+    if (!(load > 0 && load <= 1))
+      throw std::invalid_argument("Load factors must be in (0, 1]");
+  for (const size_t q : opts.q_bits)
+    for (const size_t r : opts.r_bits)
+      if (r == 0 || q + r > 64 || q > 30)
+        throw std::invalid_argument("Unsupported quotient or remainder bits");
+  return opts;
+}
+
+// ==========================================
+// Measurement
+// ==========================================
+
+static result measure_space(const options &opts, const size_t q,
+                            const size_t r, const slot_layout layout,
+                            const double load) {
+  const bench::mix_hash hash;
+  const size_t fp_bits = q + r;
+  const value_type mask =
+      fp_bits == 64 ? ~value_type{0} : (value_type{1} << fp_bits) - 1;
+  const auto n = static_cast<uint64_t>(load * std::ldexp(1.0, int(q)));
+
+  // Keys [0, n) are inserted and the following ones are queried.
+  std::vector<value_type> fps(n);
+  for (uint64_t key = 0; key != n; ++key)
+    fps[key] = hash(key) & mask;
+  quotient_filter_fp filter(q, r, layout);
+  filter.assign(fps.begin(), fps.end());
+  std::vector<value_type>().swap(fps);
+
+  uint64_t positives = 0;
+  for (uint64_t key = n; key != n + opts.queries; ++key)
+    positives += filter.count(hash(key) & mask);
+
+  result res;
+  res.q_bits = q;
+  res.r_bits = r;
+  res.layout = layout;
+  res.load_factor = load;
+  res.size = filter.size();
+  res.memory = filter.memory_usage();
+  res.bits_per_element = filter.bits_per_element();
+  res.observed_fpr =
+      static_cast<double>(positives) / static_cast<double>(opts.queries);
+  res.expected_fpr =
+      1 - std::exp(-static_cast<double>(n) / std::ldexp(1.0, int(fp_bits)));
+  res.stats = filter.statistics();
+  return res;
+}
+
+// ==========================================
+// Output
+// ==========================================
+
+static void print_table(const std::vector<result> &results) {
+  std::cout << std::setw(10) << "layout" << std::setw(4) << "q"
+            << std::setw(4) << "r" << std::setw(7) << "load" << std::setw(11)
+            << "elements" << std::setw(10) << "bits/elem" << std::setw(12)
+            << "metadata" << std::setw(12) << "remainders" << std::setw(10)
+            << "slack" << std::setw(13) << "fpr" << std::setw(13)
+            << "expected fpr" << std::setw(9) << "cluster" << std::setw(9)
+            << "p99" << std::setw(9) << "shift" << std::setw(9) << "span"
+            << '\n';
+  for (const auto &res : results) {
+    std::cout << std::setw(10) << layout_name(res.layout) << std::setw(4)
+              << res.q_bits << std::setw(4) << res.r_bits << std::fixed
+              << std::setprecision(2) << std::setw(7) << res.load_factor
+              << std::setw(11) << res.size << std::setw(10)
+              << res.bits_per_element << std::setw(12) << res.memory.metadata
+              << std::setw(12) << res.memory.remainders << std::setw(10)
+              << res.memory.slack << std::scientific << std::setprecision(3)
+              << std::setw(13) << res.observed_fpr << std::setw(13)
+              << res.expected_fpr << std::fixed << std::setprecision(2)
+              << std::setw(9) << res.stats.cluster_lengths.mean()
+              << std::setw(9) << res.stats.cluster_lengths.percentile(0.99)
+              << std::setw(9) << res.stats.shift_distances.mean()
+              << std::setw(9) << res.stats.span_lengths.mean() << '\n';
+  }
+  std::cout << "\nMemory in bytes. The last columns are the mean cluster "
+               "length, its 99th\npercentile, the mean shift and the mean "
+               "span length, in slots.\n";
+}
+
+static void write_histogram(bench::json_writer &json, const char *name,
+                            const quofil::slot_histogram &histogram) {
+  json.key(name).begin_object();
+  json.field("mean", histogram.mean());
+  json.field("p50", histogram.percentile(0.50));
+  json.field("p99", histogram.percentile(0.99));
+  json.field("max", histogram.max());
+  json.key("counts").begin_array();
+  for (const size_t count : histogram.counts)
+    json.value(count);
+  json.end();
+  json.end();
+}
+
+static void print_json(const options &opts,
+                       const std::vector<result> &results) {
+  bench::json_writer json(std::cout);
+  json.begin_object();
+  json.field("benchmark", "quotient_filter_space");
+  json.key("config").begin_object();
+  json.field("queries", opts.queries);
+  json.end();
+
+  json.key("results").begin_array();
+  for (const auto &res : results) {
+    json.begin_object();
+    json.field("q_bits", res.q_bits);
+    json.field("r_bits", res.r_bits);
+    json.field("layout", layout_name(res.layout));
+    json.field("load_factor", res.load_factor);
+    json.field("elements", res.size);
+    json.key("memory_bytes").begin_object();
+    json.field("metadata", res.memory.metadata);
+    json.field("remainders", res.memory.remainders);
+    json.field("slack", res.memory.slack);
+    json.field("total", res.memory.total());
+    json.end();
+    json.field("bits_per_element", res.bits_per_element);
+    json.field("observed_fpr", res.observed_fpr);
+    json.field("expected_fpr", res.expected_fpr);
+    write_histogram(json, "cluster_lengths", res.stats.cluster_lengths);
+    write_histogram(json, "run_lengths", res.stats.run_lengths);
+    write_histogram(json, "shift_distances", res.stats.shift_distances);
+    write_histogram(json, "span_lengths", res.stats.span_lengths);
+    json.end();
+  }
+  json.end();
+  json.end();
+}
+
+int main(int argc, char **argv) {
+  options opts;
+  try {
+    opts = parse_options(argc, argv);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << '\n';
+    return 2;
+  }
+
+  std::vector<result> results;
+  for (const slot_layout layout : opts.layouts)
+    for (const size_t q : opts.q_bits)
+      for (const size_t r : opts.r_bits)
+        for (const double load : opts.loads)
+          results.push_back(measure_space(opts, q, r, layout, load));
+
+  if (opts.json)
+    print_json(opts, results);
+  else
+    print_table(results);
+}
@@ -0,0 +1,64 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Zipfian distribution of ranks, as used by YCSB.
+
+#ifndef QUOFIL_BENCHMARKS_ZIPF_DISTRIBUTION_HPP
+#define QUOFIL_BENCHMARKS_ZIPF_DISTRIBUTION_HPP
+
+#include <random>  // for std::uniform_real_distribution
+#include <cassert> // for assert
+#include <cmath>   // for std::pow
+#include <cstdint> // for std::uint64_t
+
+namespace bench {
+
+// Generates ranks in [0, n), where rank i has a probability proportional to
+// 1 / (i + 1)^theta. Uses the method of Gray et al., "Quickly generating
+// billion-record synthetic databases", which takes constant time per value
+// after a linear setup.
+class zipf_distribution {
+public:
+  zipf_distribution(const std::uint64_t n_, const double theta_)
+      : n{n_}, theta{theta_}, zeta_n{zeta(n_, theta_)},
+        alpha{1 / (1 - theta_)},
+        eta{(1 - std::pow(2.0 / static_cast<double>(n_), 1 - theta_)) /
+            (1 - zeta(2, theta_) / zeta_n)} {
+    assert(n >= 2 && theta > 0 && theta < 1);
+  }
+
+  template <typename Generator>
+  std::uint64_t operator()(Generator &gen) {
+    const double u = uniform(gen);
+    const double uz = u * zeta_n;
+    if (uz < 1)
+      return 0;
+    if (uz < 1 + std::pow(0.5, theta))
+      return 1;
+    const auto rank = static_cast<std::uint64_t>(
+        static_cast<double>(n) * std::pow(eta * u - eta + 1, alpha));
+    return rank < n ? rank : n - 1;
+  }
+
+private:
+  static double zeta(const std::uint64_t count, const double theta) {
+    double sum = 0;
+    for (std::uint64_t i = 1; i <= count; ++i)
+      sum += 1 / std::pow(static_cast<double>(i), theta);
+    return sum;
+  }
+
+private:
+  std::uint64_t n;
+  double theta;
+  double zeta_n;
+  double alpha;
+  double eta;
+  std::uniform_real_distribution<double> uniform{0, 1};
+};
+
+} // end namespace bench
+
+#endif // Header guard
@@ -0,0 +1,64 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+/// \file
+/// \brief Defines the buffer_view class.
+
+#ifndef QUOFIL_BUFFER_VIEW_HPP
+#define QUOFIL_BUFFER_VIEW_HPP
+
+#include <utility> // for std::move
+#include <cstddef> // for std::size_t
+
+namespace quofil {
+
+enum class slot_layout;
+class quotient_filter_fp;
+template <typename Key, typename Hash, std::size_t Bits, slot_layout Layout>
+class quotient_filter;
+
+/// \brief Read-only filter whose slots live in a buffer written by
+/// <tt>save()</tt>, as returned by <tt>view_from_buffer()</tt>.
+///
+/// Only const access to the filter is given, so the buffer is never written
+/// and may be read-only memory. A copy of <tt>filter()</tt> owns its slots and
+/// can be modified.
+///
+template <typename Filter>
+class buffer_view {
+public:
+  using filter_type = Filter;
+  using size_type = typename Filter::size_type;
+  using const_iterator = typename Filter::const_iterator;
+
+public:
+  /// \brief Returns the filter which uses the slots of the buffer.
+  const Filter &filter() const noexcept { return filter_; }
+
+  template <typename T>
+  size_type count(const T &value) const {
+    return filter_.count(value);
+  }
+
+  const_iterator begin() const noexcept { return filter_.begin(); }
+  const_iterator end() const noexcept { return filter_.end(); }
+
+  bool empty() const noexcept { return filter_.empty(); }
+  size_type size() const noexcept { return filter_.size(); }
+
+private:
+  friend class quotient_filter_fp;
+  template <typename Key, typename Hash, std::size_t Bits, slot_layout Layout>
+  friend class quotient_filter;
+
+  explicit buffer_view(Filter &&filter) noexcept
+      : filter_(std::move(filter)) {}
+
+private:
+  Filter filter_;
+};
+
+} // end namespace quofil
+
+#endif // Header guard
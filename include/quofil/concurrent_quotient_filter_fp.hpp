@@ -0,0 +1,155 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+/// \file
+/// \brief Defines the concurrent_quotient_filter_fp class.
+
+#ifndef QUOFIL_CONCURRENT_QUOTIENT_FILTER_FP_HPP
+#define QUOFIL_CONCURRENT_QUOTIENT_FILTER_FP_HPP
+
+#include <quofil/quotient_filter_fp.hpp> // for quofil::quotient_filter_fp
+
+#include <atomic>  // for std::atomic
+#include <memory>  // for std::unique_ptr
+#include <mutex>   // for std::mutex
+#include <cstdint> // for std::uint32_t
+
+namespace quofil {
+
+/// \brief Quotient-Filter of fixed size which can be accessed concurrently.
+///
+/// The slots are divided into lock regions. An insertion or an erasure locks
+/// only the regions spanned by the cluster it modifies, acquiring them in
+/// ascending order, so threads working on different parts of the filter do
+/// not contend.
+///
+/// Lookups usually neither lock nor write shared memory, so they scale with
+/// the number of reader threads. Every block of 64 slots has a version counter
+/// which writers increment before and after modifying the block. Readers copy
+/// the blocks they scan, taking their versions before and checking them
+/// afterward, and retry if a writer got in the way. A lookup locks the
+/// regions of its cluster, as writers do, when its run spans more than 4
+/// blocks or when writers keep getting in the way.
+///
+/// All member functions are thread-safe. The filter never grows.
+class concurrent_quotient_filter_fp {
+public:
+  using value_type = quotient_filter_fp::value_type;
+  using size_type = quotient_filter_fp::size_type;
+
+  /// \brief The default number of bits of the region size, i.e. 4096 slots.
+  static constexpr size_type default_region_bits = 12;
+
+public:
+  /// \brief Constructs an empty concurrent quotient filter using the given
+  /// bits requirements.
+  ///
+  /// Afterward, all inserted, searched and queried fingerprints must be less
+  /// than <tt>1 << r + q</tt>, otherwise the behavior is undefined.
+  ///
+  /// \param q The number of bits for the quotient.
+  /// \param r The number of bits for the remainder.
+  /// \param region_bits The number of bits of the region size. It is clamped
+  /// to the range <tt>[6, q]</tt>, so that regions hold whole blocks.
+  /// \param layout The memory layout of the slots.
+  ///
+  /// \pre \p q shall be at least 8 and \p r shall be positive.
+  ///
+  concurrent_quotient_filter_fp(size_type q, size_type r,
+                                size_type region_bits = default_region_bits,
+                                slot_layout layout = slot_layout::separate);
+
+  concurrent_quotient_filter_fp(const concurrent_quotient_filter_fp &) =
+      delete;
+  concurrent_quotient_filter_fp &
+  operator=(const concurrent_quotient_filter_fp &) = delete;
+
+  ~concurrent_quotient_filter_fp();
+
+  /// \brief Inserts the given fingerprint.
+  ///
+  /// \returns Whether the insertion took place, i.e. whether the fingerprint
+  /// was not contained yet.
+  ///
+  /// \throws filter_is_full if <tt>size() == max_size()</tt> and the
+  /// fingerprint is not contained yet.
+  ///
+  bool insert(value_type fp);
+
+  /// \brief Erases the given fingerprint.
+  ///
+  /// \returns The number of erased elements, effectively 0 or 1.
+  size_type erase(value_type fp);
+
+  /// \brief Counts the elements which match the given fingerprint,
+  /// effectively 0 or 1.
+  ///
+  /// It makes at most 8 attempts without locking, fewer if the run outgrows
+  /// the blocks searched by them, and then searches under the locks.
+  ///
+  /// \throws std::system_error if the locks can not be acquired.
+  ///
+  size_type count(value_type fp) const;
+
+  /// \brief Returns the number of stored fingerprints.
+  size_type size() const noexcept {
+    return num_items.load(std::memory_order_relaxed);
+  }
+
+  /// \brief Checks whether the filter is empty.
+  bool empty() const noexcept { return size() == 0; }
+
+  /// \brief Returns the maximum number of fingerprints the filter can hold.
+  ///
+  /// A couple of blocks of slots are always kept free, so that a cluster
+  /// never wraps around the filter up to the block where it begins.
+  size_type max_size() const noexcept;
+
+  /// \brief Returns the number of slots of the filter.
+  size_type capacity() const noexcept { return filter.capacity(); }
+
+  /// \brief Returns the number of slots of each lock region.
+  size_type region_slots() const noexcept {
+    return size_type{1} << region_shift;
+  }
+
+  /// \brief Returns the number of bits used for the quotient.
+  size_type quotient_bits() const noexcept { return filter.quotient_bits(); }
+
+  /// \brief Returns the number of bits used for the remainder.
+  size_type remainder_bits() const noexcept { return filter.remainder_bits(); }
+
+  /// \brief Returns the memory layout of the slots.
+  slot_layout layout() const noexcept { return filter.layout(); }
+
+private:
+  class region_lock;
+
+  size_type region_of(size_type pos) const noexcept {
+    return pos >> region_shift;
+  }
+  size_type canonical_pos(value_type) const noexcept;
+  bool has_empty_slot(size_type, size_type) const noexcept;
+  static bool lookup(const quotient_filter_fp &, size_type, value_type,
+                     size_type, size_type &) noexcept;
+  void copy_blocks(quotient_filter_fp &, size_type) const noexcept;
+  bool try_lookup(value_type, size_type &, bool &) const noexcept;
+  bool locked_lookup(value_type) const;
+  void reserve_slot();
+
+private:
+  // The element count of the inner filter is never updated. It stays at zero,
+  // so the inner filter always uses the offsets of the blocks, which only
+  // depend on the regions being modified.
+  quotient_filter_fp filter;
+  size_type region_shift;
+  size_type num_regions;
+  std::unique_ptr<std::mutex[]> regions;
+  std::unique_ptr<std::atomic<std::uint32_t>[]> versions; // One per block.
+  std::atomic<size_type> num_items{0};
+};
+
+} // end namespace quofil
+
+#endif // Header guard
@@ -0,0 +1,114 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+/// \file
+/// \brief Defines the counting_quotient_filter_fp class.
+
+#ifndef QUOFIL_COUNTING_QUOTIENT_FILTER_FP_HPP
+#define QUOFIL_COUNTING_QUOTIENT_FILTER_FP_HPP
+
+#include <quofil/quotient_filter_fp.hpp> // for quofil::quotient_filter_fp
+
+namespace quofil {
+
+/// \brief Quotient-Filter which keeps the multiplicity of each fingerprint.
+///
+/// Repeated fingerprints are stored once, followed by a variable-length
+/// counter in the slots of the same run. A fingerprint inserted once takes a
+/// single slot, like in quotient_filter_fp, and bigger counts take a number of
+/// slots logarithmic in the count, except for the remainders 0 and 1.
+class counting_quotient_filter_fp {
+public:
+  using value_type = quotient_filter_fp::value_type;
+  using size_type = quotient_filter_fp::size_type;
+
+public:
+  /// \brief Constructs a counting quotient filter with zero capacity.
+  counting_quotient_filter_fp() = default;
+
+  /// \brief Constructs a counting quotient filter using the given bits
+  /// requirements.
+  ///
+  /// Afterward, all inserted, searched and queried fingerprints must be less
+  /// than <tt>1 << r + q</tt>, otherwise the behavior is undefined.
+  ///
+  /// \param q The number of bits for the quotient.
+  /// \param r The number of bits for the remainder.
+  /// \param layout The memory layout of the slots.
+  ///
+  /// \pre \p r shall be positive.
+  ///
+  counting_quotient_filter_fp(size_type q, size_type r,
+                              slot_layout layout = slot_layout::separate)
+      : filter(q, r, layout) {}
+
+  /// \brief Returns how many times the given fingerprint has been inserted
+  /// (and not erased).
+  size_type count(value_type fp) const noexcept;
+
+  /// \brief Inserts the given fingerprint \p n times.
+  ///
+  /// \param fp The fingerprint to be inserted.
+  /// \param n The number of insertions.
+  ///
+  /// \returns The new count of \p fp.
+  ///
+  /// \throws filter_is_full if there are not enough free slots to store the
+  /// new count. In such case the filter is not modified.
+  ///
+  /// \pre \p n shall be positive.
+  ///
+  size_type insert(value_type fp, size_type n = 1);
+
+  /// \brief Erases one occurrence of the given fingerprint, if any.
+  ///
+  /// \param fp The fingerprint to be erased.
+  ///
+  /// \returns The number of erased occurrences, effectively 0 or 1.
+  size_type erase(value_type fp) noexcept;
+
+  /// \brief Clears the contents.
+  void clear() noexcept {
+    filter.clear();
+    num_items = 0;
+  }
+
+  /// \brief Returns the number of stored fingerprints, counting repetitions.
+  size_type size() const noexcept { return num_items; }
+
+  /// \brief Checks whether the filter is empty.
+  bool empty() const noexcept { return num_items == 0; }
+
+  /// \brief Returns the number of slots in use. A slot holds either a
+  /// fingerprint or a part of a counter.
+  size_type used_slots() const noexcept { return filter.size(); }
+
+  /// \brief Returns the number of slots of the filter.
+  size_type capacity() const noexcept { return filter.capacity(); }
+
+  /// \brief Returns the number of bits used for the quotient.
+  size_type quotient_bits() const noexcept { return filter.quotient_bits(); }
+
+  /// \brief Returns the number of bits used for the remainder.
+  size_type remainder_bits() const noexcept { return filter.remainder_bits(); }
+
+  /// \brief Returns the memory layout of the slots.
+  slot_layout layout() const noexcept { return filter.layout(); }
+
+private:
+  struct entry;
+
+  entry find_entry(size_type, size_type, value_type) const noexcept;
+  entry decode_entry(size_type, size_type, size_type) const noexcept;
+  void write_entry(size_type, const entry &) noexcept;
+  size_type entry_length(value_type, size_type) const noexcept;
+
+private:
+  quotient_filter_fp filter;
+  size_type num_items = 0;
+};
+
+} // end namespace quofil
+
+#endif // Header guard
@@ -0,0 +1,100 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+/// \file
+/// \brief Defines the cache_aligned_allocator class.
+
+#ifndef QUOFIL_DETAIL_CACHE_ALIGNED_ALLOCATOR_HPP
+#define QUOFIL_DETAIL_CACHE_ALIGNED_ALLOCATOR_HPP
+
+#include <algorithm> // for std::min
+#include <limits>    // for std::numeric_limits
+#include <new>       // for std::bad_alloc
+#include <cstddef>   // for std::size_t
+#include <cstdint>   // for std::uintptr_t
+#include <cstdlib>   // for std::malloc, std::realloc, std::free
+#include <cstring>   // for std::memmove
+
+namespace quofil {
+namespace detail {
+
+/// \brief Allocator whose allocations always start at a cache line boundary.
+///
+/// The address returned by <tt>std::malloc</tt> is stored right before the
+/// aligned block so it can be released or reallocated later.
+template <typename T>
+class cache_aligned_allocator {
+public:
+  using value_type = T;
+
+  static constexpr std::size_t alignment = 64;
+
+public:
+  cache_aligned_allocator() = default;
+
+  template <typename U>
+  cache_aligned_allocator(const cache_aligned_allocator<U> &) noexcept {}
+
+  T *allocate(std::size_t n) {
+    return reallocate(nullptr, 0, n);
+  }
+
+  /// \brief Resizes the allocation of \p old_n elements at \p ptr to \p n
+  /// elements, keeping the first <tt>min(old_n, n)</tt> ones.
+  ///
+  /// The allocation is extended in place whenever <tt>std::realloc</tt> can
+  /// do it. If \p ptr is null, a new allocation is made. On failure,
+  /// <tt>std::bad_alloc</tt> is thrown and \p ptr is left untouched.
+  T *reallocate(T *ptr, std::size_t old_n, std::size_t n) {
+    constexpr std::size_t extra = alignment + sizeof(void *);
+    if (n > (std::numeric_limits<std::size_t>::max() - extra) / sizeof(T))
+      throw std::bad_alloc();
+
+    // realloc keeps the offset of the elements, not their alignment. The
+    // offset is taken beforehand, since realloc could free the old block.
+    void *const old_raw = ptr ? raw_address(ptr) : nullptr;
+    const std::uintptr_t offset =
+        ptr ? reinterpret_cast<std::uintptr_t>(ptr) -
+                  reinterpret_cast<std::uintptr_t>(old_raw)
+            : 0;
+    void *const raw = std::realloc(old_raw, n * sizeof(T) + extra);
+    if (!raw)
+      throw std::bad_alloc();
+
+    const auto first = reinterpret_cast<std::uintptr_t>(raw) + sizeof(void *);
+    const auto aligned = (first + alignment - 1) & ~(alignment - 1);
+    if (old_n != 0) {
+      const auto moved = reinterpret_cast<std::uintptr_t>(raw) + offset;
+      if (moved != aligned)
+        std::memmove(reinterpret_cast<void *>(aligned),
+                     reinterpret_cast<const void *>(moved),
+                     std::min(old_n, n) * sizeof(T));
+    }
+    void **const header = reinterpret_cast<void **>(aligned) - 1;
+    *header = raw;
+    return reinterpret_cast<T *>(aligned);
+  }
+
+  void deallocate(T *ptr, std::size_t) noexcept { std::free(raw_address(ptr)); }
+
+  friend bool operator==(const cache_aligned_allocator &,
+                         const cache_aligned_allocator &) noexcept {
+    return true;
+  }
+
+  friend bool operator!=(const cache_aligned_allocator &,
+                         const cache_aligned_allocator &) noexcept {
+    return false;
+  }
+
+private:
+  static void *raw_address(T *ptr) noexcept {
+    return *(reinterpret_cast<void **>(ptr) - 1);
+  }
+};
+
+} // end namespace detail
+} // end namespace quofil
+
+#endif // Header guard
@@ -0,0 +1,67 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+/// \file
+/// \brief Defines helpers to run work on several threads.
+
+#ifndef QUOFIL_DETAIL_PARALLEL_HPP
+#define QUOFIL_DETAIL_PARALLEL_HPP
+
+#include <algorithm> // for std::min
+#include <exception> // for std::exception_ptr, std::current_exception
+#include <thread>    // for std::thread
+#include <vector>    // for std::vector
+#include <cstddef>   // for std::size_t
+
+namespace quofil {
+namespace detail {
+
+/// \brief Returns the number of threads to be used when the user asks for
+/// \p requested threads, where zero means one per hardware thread.
+inline unsigned thread_count(unsigned requested) noexcept {
+  if (requested == 0)
+    requested = std::thread::hardware_concurrency();
+  return requested == 0 ? 1 : requested;
+}
+
+/// \brief Calls <tt>f(i)</tt> for every \c i in <tt>[0, num_threads)</tt>,
+/// each one on its own thread, and waits for all of them.
+///
+/// The calling thread runs <tt>f(0)</tt>. If any call throws, the first
+/// exception is rethrown once every thread has finished.
+template <typename Function>
+void run_parallel(const unsigned num_threads, Function f) {
+  std::vector<std::exception_ptr> errors(num_threads);
+  const auto guarded = [&](unsigned i) {
+    try {
+      f(i);
+    } catch (...) {
+      errors[i] = std::current_exception();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads);
+  for (unsigned i = 1; i < num_threads; ++i)
+    threads.emplace_back(guarded, i);
+  guarded(0);
+  for (auto &thread : threads)
+    thread.join();
+
+  for (const auto &error : errors)
+    if (error)
+      std::rethrow_exception(error);
+}
+
+/// \brief Returns the beginning of the chunk \p i when \p n elements are
+/// split into \p num_chunks chunks of almost equal size.
+inline std::size_t chunk_begin(std::size_t n, std::size_t num_chunks,
+                               std::size_t i) noexcept {
+  return n / num_chunks * i + std::min(n % num_chunks, i);
+}
+
+} // end namespace detail
+} // end namespace quofil
+
+#endif // Header guard
@@ -0,0 +1,48 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+/// \file
+/// \brief Defines relaxed atomic accesses to plain words.
+
+#ifndef QUOFIL_DETAIL_RELAXED_WORD_HPP
+#define QUOFIL_DETAIL_RELAXED_WORD_HPP
+
+#include <type_traits> // for std::is_integral
+
+namespace quofil {
+namespace detail {
+
+// The slots of a filter are plain words, so the filter can be copied, saved
+// or mapped as raw memory. However, concurrent_quotient_filter_fp reads the
+// words of blocks which are being modified, discarding what it read if their
+// versions changed. The following functions access a word atomically with
+// relaxed ordering, so those accesses are not data races. On common hardware
+// they are ordinary loads and stores of aligned words.
+
+/// \brief Loads \p word with a relaxed atomic load.
+template <typename T>
+inline T load_relaxed(const T &word) noexcept {
+  static_assert(std::is_integral<T>::value, "Only words can be loaded");
+#if defined(__GNUC__)
+  return __atomic_load_n(&word, __ATOMIC_RELAXED);
+#else
+  return *static_cast<const volatile T *>(&word);
+#endif
+}
+
+/// \brief Stores \p value into \p word with a relaxed atomic store.
+template <typename T>
+inline void store_relaxed(T &word, const T value) noexcept {
+  static_assert(std::is_integral<T>::value, "Only words can be stored");
+#if defined(__GNUC__)
+  __atomic_store_n(&word, value, __ATOMIC_RELAXED);
+#else
+  *static_cast<volatile T *>(&word) = value;
+#endif
+}
+
+} // end namespace detail
+} // end namespace quofil
+
+#endif // Header guard
@@ -0,0 +1,116 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+/// \file
+/// \brief Defines the word_buffer class.
+
+#ifndef QUOFIL_DETAIL_WORD_BUFFER_HPP
+#define QUOFIL_DETAIL_WORD_BUFFER_HPP
+
+#include <quofil/detail/cache_aligned_allocator.hpp>
+
+#include <algorithm>   // for std::min
+#include <type_traits> // for std::is_trivially_copyable
+#include <utility>     // for std::swap
+#include <cstddef>     // for std::size_t
+#include <cstring>     // for std::memcpy, std::memset
+
+namespace quofil {
+namespace detail {
+
+/// \brief Array of words which is either owned, allocated at a cache line
+/// boundary, or borrowed from external memory such as a mapped file.
+///
+/// Copies are always owned. Moves keep the original memory.
+template <typename T>
+class word_buffer {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "The words are copied and reallocated as raw memory.");
+
+public:
+  word_buffer() = default;
+
+  /// \brief Allocates \p n zeroed words.
+  explicit word_buffer(std::size_t n)
+      : ptr{n == 0 ? nullptr : allocator().allocate(n)}, len{n}, owned{true} {
+    if (n != 0)
+      std::memset(ptr, 0, n * sizeof(T));
+  }
+
+  /// \brief Refers to \p n words at \p external, which must outlive the
+  /// buffer.
+  word_buffer(T *external, std::size_t n) noexcept : ptr{external}, len{n} {}
+
+  word_buffer(const word_buffer &other) : word_buffer(other.len) {
+    if (len != 0)
+      std::memcpy(ptr, other.ptr, len * sizeof(T));
+  }
+
+  word_buffer(word_buffer &&other) noexcept : ptr{other.ptr},
+                                              len{other.len},
+                                              owned{other.owned} {
+    other.ptr = nullptr;
+    other.len = 0;
+    other.owned = false;
+  }
+
+  word_buffer &operator=(word_buffer other) noexcept {
+    swap(other);
+    return *this;
+  }
+
+  ~word_buffer() {
+    if (owned && ptr)
+      allocator().deallocate(ptr, len);
+  }
+
+  void swap(word_buffer &other) noexcept {
+    std::swap(ptr, other.ptr);
+    std::swap(len, other.len);
+    std::swap(owned, other.owned);
+  }
+
+  /// \brief Changes the number of words to \p n, keeping the first
+  /// <tt>min(n, size())</tt> ones. The added words are zero.
+  ///
+  /// Owned words are reallocated, in place when possible. External words are
+  /// copied into owned ones.
+  void resize(std::size_t n) {
+    if (n == len)
+      return;
+    if (!owned || len == 0 || n == 0) {
+      word_buffer resized(n);
+      if (len != 0 && n != 0)
+        std::memcpy(resized.ptr, ptr, std::min(n, len) * sizeof(T));
+      swap(resized);
+      return;
+    }
+    ptr = allocator().reallocate(ptr, len, n);
+    if (n > len)
+      std::memset(ptr + len, 0, (n - len) * sizeof(T));
+    len = n;
+  }
+
+  T &operator[](std::size_t i) noexcept { return ptr[i]; }
+  const T &operator[](std::size_t i) const noexcept { return ptr[i]; }
+
+  T *data() noexcept { return ptr; }
+  const T *data() const noexcept { return ptr; }
+  std::size_t size() const noexcept { return len; }
+
+  /// \brief Checks whether the words live in external memory.
+  bool is_external() const noexcept { return ptr && !owned; }
+
+private:
+  using allocator = cache_aligned_allocator<T>;
+
+  T *ptr = nullptr;
+  std::size_t len = 0;
+  bool owned = false;
+};
+
+} // end namespace detail
+} // end namespace quofil
+
+#endif // Header guard
@@ -0,0 +1,135 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+/// \file
+/// \brief Defines the mapped_quotient_filter_fp class.
+
+#ifndef QUOFIL_MAPPED_QUOTIENT_FILTER_FP_HPP
+#define QUOFIL_MAPPED_QUOTIENT_FILTER_FP_HPP
+
+#include <quofil/quotient_filter_fp.hpp> // for quofil::quotient_filter_fp
+
+#include <string>  // for std::string
+#include <utility> // for std::pair
+#include <cstddef> // for std::size_t
+
+namespace quofil {
+
+/// \brief Quotient-Filter whose slots live in a memory-mapped file.
+///
+/// The file holds a small header followed by the slots, laid out exactly as in
+/// memory, so opening a filter only maps the file and validates the header.
+/// The operating system pages the slots in lazily and writes the modified
+/// ones back.
+///
+/// Every modification also updates the element count stored in the header, so
+/// the file holds the right count even if the process ends without unmapping
+/// it. The filter has a fixed capacity.
+///
+/// \note Only available on POSIX systems.
+///
+class mapped_quotient_filter_fp {
+public:
+  using value_type = quotient_filter_fp::value_type;
+  using size_type = quotient_filter_fp::size_type;
+  using iterator = quotient_filter_fp::iterator;
+  using const_iterator = quotient_filter_fp::const_iterator;
+
+public:
+  /// \brief Creates a file holding an empty filter and maps it. An existing
+  /// file is overwritten.
+  ///
+  /// \param path The path of the file.
+  /// \param q The number of bits for the quotient.
+  /// \param r The number of bits for the remainder.
+  /// \param layout The memory layout of the slots.
+  ///
+  /// \throws std::system_error if the file can not be created or mapped.
+  ///
+  /// \pre \p r shall be positive.
+  ///
+  static mapped_quotient_filter_fp
+  create(const std::string &path, size_type q, size_type r,
+         slot_layout layout = slot_layout::separate);
+
+  /// \brief Maps the filter stored in the given file.
+  ///
+  /// It takes constant time, no matter the size of the filter.
+  ///
+  /// \throws std::system_error if the file can not be opened or mapped.
+  /// \throws bad_filter_format if the file does not hold a filter which can
+  /// be used on this machine.
+  ///
+  static mapped_quotient_filter_fp open(const std::string &path);
+
+  mapped_quotient_filter_fp(mapped_quotient_filter_fp &&) noexcept;
+  mapped_quotient_filter_fp &operator=(mapped_quotient_filter_fp &&) noexcept;
+
+  /// \brief Unmaps the file.
+  ~mapped_quotient_filter_fp();
+
+  /// \brief Returns the filter which uses the mapped slots.
+  ///
+  /// It can be used for any read-only operation. A copy of it lives in
+  /// memory.
+  const quotient_filter_fp &filter() const noexcept { return filter_; }
+
+  const_iterator find(value_type fp) const noexcept { return filter_.find(fp); }
+  size_type count(value_type fp) const noexcept { return filter_.count(fp); }
+
+  std::pair<iterator, bool> insert(value_type fp) {
+    const auto result = filter_.insert(fp);
+    store_size();
+    return result;
+  }
+
+  void erase(const_iterator pos) noexcept {
+    filter_.erase(pos);
+    store_size();
+  }
+  size_type erase(value_type fp) noexcept {
+    const size_type erased = filter_.erase(fp);
+    store_size();
+    return erased;
+  }
+  void clear() noexcept {
+    filter_.clear();
+    store_size();
+  }
+
+  const_iterator begin() const noexcept { return filter_.begin(); }
+  const_iterator end() const noexcept { return filter_.end(); }
+
+  bool empty() const noexcept { return filter_.empty(); }
+  bool full() const noexcept { return filter_.full(); }
+  size_type size() const noexcept { return filter_.size(); }
+  size_type capacity() const noexcept { return filter_.capacity(); }
+  size_type quotient_bits() const noexcept { return filter_.quotient_bits(); }
+  size_type remainder_bits() const noexcept {
+    return filter_.remainder_bits();
+  }
+  slot_layout layout() const noexcept { return filter_.layout(); }
+
+  /// \brief Writes the modified slots to the file, waiting for the writes to
+  /// complete.
+  ///
+  /// \throws std::system_error if the writes fail.
+  ///
+  void sync();
+
+private:
+  mapped_quotient_filter_fp(quotient_filter_fp &&, void *,
+                            std::size_t) noexcept;
+  void store_size() noexcept;
+  void unmap() noexcept;
+
+private:
+  quotient_filter_fp filter_;
+  void *address = nullptr; // Beginning of the mapping, i.e. the header.
+  std::size_t length = 0;  // Bytes of the mapping.
+};
+
+} // end namespace quofil
+
+#endif // Header guard
@@ -9,24 +9,44 @@
 #define QUOFIL_QUOTIENT_FILTER_HPP
 
 #include <quofil/quotient_filter_fp.hpp> // for quofil::quotient_filter_fp
+#include <quofil/detail/parallel.hpp>    // for quofil::detail::run_parallel
 
 #include <algorithm>        // for std::{equal, min, max, for_each}
 #include <functional>       // for std::hash
 #include <initializer_list> // for std::initializer_list
 #include <limits>           // for std::numeric_limits
+#include <iosfwd>           // for std::istream, std::ostream
+#include <stdexcept>        // for std::length_error
+#include <type_traits>      // for std::integral_constant
 #include <utility>          // for std::{pair, move, swap}
+#include <vector>           // for std::vector
 #include <cassert>          // for assert
-#include <cmath>            // for std::ceil
-#include <cstddef>          // for std::size_t
+#include <cmath>            // for std::ceil, std::nextafter
+#include <cstddef>          // for std::size_t, std::ptrdiff_t
+#include <cstdint>          // for std::uint64_t
 
 namespace quofil {
 
+/// \brief Identifies a hash function in stored filters.
+///
+/// The tag is written by <tt>quotient_filter::save()</tt> and checked when
+/// the filter is loaded, so a filter is never queried with another hash
+/// function. Specialize it with a distinct nonzero value for each hash
+/// function (and version of it) whose filters are stored.
+///
+/// The primary template has the value zero, meaning that the hash function
+/// has no tag. Filters using such a function can not be stored.
+template <typename Hash>
+struct hash_tag : std::integral_constant<std::uint64_t, 0> {};
+
 template <typename Key, typename Hash = std::hash<Key>,
-          std::size_t Bits = std::numeric_limits<std::size_t>::digits>
+          std::size_t Bits = std::numeric_limits<std::size_t>::digits,
+          slot_layout Layout = slot_layout::separate>
 class quotient_filter {
 
 public:
   static constexpr std::size_t hash_bits = Bits;
+  static constexpr slot_layout layout = Layout;
 
 public:
   using key_type = Key;
@@ -114,6 +134,24 @@ public:
   ///
   size_type slot_count() const noexcept { return filter.capacity(); }
 
+  /// \brief Returns the bytes of memory used by the slots, by component.
+  ///
+  /// See <tt>quotient_filter_fp::memory_usage()</tt>.
+  memory_footprint memory_usage() const noexcept {
+    return filter.memory_usage();
+  }
+
+  /// \brief Returns the bits of memory used per element, or 0 if the filter
+  /// is empty.
+  double bits_per_element() const noexcept {
+    return filter.bits_per_element();
+  }
+
+  /// \brief Measures the clusters, runs and spans of the filter.
+  ///
+  /// See <tt>quotient_filter_fp::statistics()</tt>.
+  filter_statistics statistics() const { return filter.statistics(); }
+
   // Modifiers.
   void clear() noexcept { filter.clear(); }
 
@@ -140,6 +178,60 @@ public:
     return filter.erase(hash_fn(key));
   }
 
+  /// \brief Inserts all the elements (hash values) of another filter.
+  ///
+  /// Both filters are merged in a single pass over their ordered elements,
+  /// so it takes linear time. The filter is regenerated so that the union fits
+  /// within <tt>max_load_factor()</tt>. All iterators are invalidated.
+  ///
+  /// \param other A filter whose keys were hashed in the same way.
+  ///
+  void merge(const quotient_filter &other) {
+    assign_merged(*this, other, size() + other.size(),
+                  &quotient_filter_fp::assign_union);
+  }
+
+  /// \brief Erases the elements (hash values) which are not contained in
+  /// another filter.
+  ///
+  /// Both filters are merged in a single pass over their ordered elements,
+  /// so it takes linear time. All iterators are invalidated.
+  ///
+  /// \param other A filter whose keys were hashed in the same way.
+  ///
+  void intersect(const quotient_filter &other) {
+    assign_merged(*this, other, std::min(size(), other.size()),
+                  &quotient_filter_fp::assign_intersection);
+  }
+
+  /// \brief Erases the elements (hash values) which are contained in another
+  /// filter.
+  ///
+  /// Both filters are merged in a single pass over their ordered elements,
+  /// so it takes linear time. All iterators are invalidated.
+  ///
+  /// \param other A filter whose keys were hashed in the same way.
+  ///
+  void subtract(const quotient_filter &other) {
+    assign_merged(*this, other, size(), &quotient_filter_fp::assign_difference);
+  }
+
+  /// \brief Replaces the contents with the keys of a range, using several
+  /// threads.
+  ///
+  /// The keys are hashed in parallel and the filter is built with
+  /// <tt>quotient_filter_fp::assign_parallel()</tt>. The filter is
+  /// regenerated so that all the keys fit within <tt>max_load_factor()</tt>,
+  /// but it keeps at least its current slots. All iterators are invalidated.
+  ///
+  /// \param first Beginning of the range.
+  /// \param last End of the range.
+  /// \param num_threads The number of threads to be used. Zero means one per
+  /// hardware thread.
+  ///
+  template <typename RandomIt>
+  void assign_parallel(RandomIt first, RandomIt last, unsigned num_threads = 0);
+
   void swap(quotient_filter &other) { std::swap(*this, other); }
 
   // Lookup
@@ -151,6 +243,62 @@ public:
     return filter.find(hash_fn(key));
   }
 
+  /// \brief Counts a sequence of keys.
+  ///
+  /// Equivalent to calling <tt>count()</tt> for each key, but the keys are
+  /// hashed in batches and the slots of each batch are prefetched, so the
+  /// memory accesses of several lookups overlap.
+  ///
+  /// \param first Beginning of the keys.
+  /// \param last End of the keys.
+  /// \param out Beginning of the destination of the counts. It could be, for
+  /// example, a bitmap such as <tt>std::vector<bool></tt>.
+  ///
+  /// \returns Output iterator to the element past the last count written.
+  ///
+  template <typename InputIt, typename OutputIt>
+  OutputIt count_many(InputIt first, InputIt last, OutputIt out) const {
+    using hash_ptr = const size_type *;
+    return for_each_hash_batch(
+        first, last, out, [this](hash_ptr batch_first, hash_ptr batch_last,
+                                 OutputIt batch_out) {
+          return filter.count_many(batch_first, batch_last, batch_out);
+        });
+  }
+
+  /// \brief Searchs for a sequence of keys.
+  ///
+  /// Equivalent to calling <tt>find()</tt> for each key. See
+  /// <tt>count_many()</tt>.
+  ///
+  /// \returns Output iterator to the element past the last iterator written.
+  ///
+  template <typename InputIt, typename OutputIt>
+  OutputIt find_many(InputIt first, InputIt last, OutputIt out) const {
+    using hash_ptr = const size_type *;
+    return for_each_hash_batch(
+        first, last, out, [this](hash_ptr batch_first, hash_ptr batch_last,
+                                 OutputIt batch_out) {
+          return filter.find_many(batch_first, batch_last, batch_out);
+        });
+  }
+
+  /// \brief Same as <tt>count_many()</tt> but takes the hash values of the
+  /// keys, previously computed with <tt>hash_function()</tt>.
+  template <typename ForwardIt, typename OutputIt>
+  OutputIt count_many_hashed(ForwardIt first, ForwardIt last,
+                             OutputIt out) const {
+    return filter.count_many(first, last, out);
+  }
+
+  /// \brief Same as <tt>find_many()</tt> but takes the hash values of the
+  /// keys, previously computed with <tt>hash_function()</tt>.
+  template <typename ForwardIt, typename OutputIt>
+  OutputIt find_many_hashed(ForwardIt first, ForwardIt last,
+                            OutputIt out) const {
+    return filter.find_many(first, last, out);
+  }
+
   // Hash policy
   float load_factor() const noexcept {
     return empty() ? 0.0f : float(size()) / float(slot_count());
@@ -174,6 +322,15 @@ public:
   ///
   void regenerate(size_type slot_count);
 
+  /// \brief Releases the unused slots.
+  ///
+  /// Sets the <tt>slot_count()</tt> to the minimal valid value according to
+  /// the current number of elements and <tt>max_load_factor()</tt>. The hash
+  /// values are not recomputed and the new slots are written in a single
+  /// pass.
+  ///
+  void shrink_to_fit() { regenerate(0); }
+
   /// \brief Reserves space for at least the specified number of elements.
   ///
   /// Sets the number of slots to the minimal value needed for holding at least
@@ -190,6 +347,50 @@ public:
   // Observers
   hasher hash_function() const { return hash_fn; }
 
+  // Serialization
+
+  /// \brief Writes the filter to a binary stream.
+  ///
+  /// Uses the format of <tt>quotient_filter_fp::save()</tt>, tagged with
+  /// <tt>hash_tag<Hash></tt>. The maximum load factor is not stored.
+  ///
+  void save(std::ostream &os) const {
+    static_assert(hash_tag<Hash>::value != 0,
+                  "Specialize quofil::hash_tag to store the filters");
+    filter.save(os, hash_tag<Hash>::value);
+  }
+
+  /// \brief Reads a filter written by <tt>save()</tt>.
+  ///
+  /// The filter gets the default maximum load factor, or the current load
+  /// factor if it is greater.
+  ///
+  /// \throws bad_filter_format if the stream does not hold a filter with the
+  /// same <tt>hash_bits</tt>, \c layout and hash tag.
+  ///
+  static quotient_filter load(std::istream &is, const Hash &hash = Hash()) {
+    static_assert(hash_tag<Hash>::value != 0,
+                  "Specialize quofil::hash_tag to store the filters");
+    return from_stored(quotient_filter_fp::load(is, hash_tag<Hash>::value),
+                       hash);
+  }
+
+  /// \brief Returns a read-only view of the filter stored in a buffer
+  /// written by <tt>save()</tt>, which uses its slots without copying them.
+  ///
+  /// See <tt>quotient_filter_fp::view_from_buffer()</tt> and <tt>load()</tt>.
+  ///
+  static buffer_view<quotient_filter>
+  view_from_buffer(const void *data, size_type size,
+                   const Hash &hash = Hash()) {
+    static_assert(hash_tag<Hash>::value != 0,
+                  "Specialize quofil::hash_tag to store the filters");
+    auto stored = quotient_filter_fp::view_from_buffer(data, size,
+                                                       hash_tag<Hash>::value);
+    return buffer_view<quotient_filter>(
+        from_stored(std::move(stored.filter_), hash));
+  }
+
   // Non-member functions.
 
   friend bool operator==(const quotient_filter &lhs,
@@ -207,6 +408,49 @@ public:
     lhs.swap(rhs);
   }
 
+  /// \brief Returns a filter with the elements of both filters.
+  ///
+  /// The result uses the hash function and the maximum load factor of \p lhs.
+  /// See <tt>merge()</tt>.
+  ///
+  friend quotient_filter union_of(const quotient_filter &lhs,
+                                  const quotient_filter &rhs) {
+    quotient_filter result(0, lhs.hash_fn);
+    result.max_load_factor_ = lhs.max_load_factor_;
+    result.assign_merged(lhs, rhs, lhs.size() + rhs.size(),
+                         &quotient_filter_fp::assign_union);
+    return result;
+  }
+
+  /// \brief Returns a filter with the elements contained in both filters.
+  ///
+  /// The result uses the hash function and the maximum load factor of \p lhs.
+  /// See <tt>intersect()</tt>.
+  ///
+  friend quotient_filter intersection_of(const quotient_filter &lhs,
+                                         const quotient_filter &rhs) {
+    quotient_filter result(0, lhs.hash_fn);
+    result.max_load_factor_ = lhs.max_load_factor_;
+    result.assign_merged(lhs, rhs, std::min(lhs.size(), rhs.size()),
+                         &quotient_filter_fp::assign_intersection);
+    return result;
+  }
+
+  /// \brief Returns a filter with the elements of \p lhs which are not
+  /// contained in \p rhs.
+  ///
+  /// The result uses the hash function and the maximum load factor of \p lhs.
+  /// See <tt>subtract()</tt>.
+  ///
+  friend quotient_filter difference_of(const quotient_filter &lhs,
+                                       const quotient_filter &rhs) {
+    quotient_filter result(0, lhs.hash_fn);
+    result.max_load_factor_ = lhs.max_load_factor_;
+    result.assign_merged(lhs, rhs, lhs.size(),
+                         &quotient_filter_fp::assign_difference);
+    return result;
+  }
+
 private:
   // Returns the minimal q_bits such that at least slot_count slots are
   // available.
@@ -224,6 +468,39 @@ private:
     return std::min(static_cast<size_type>(ans), slot_count());
   }
 
+  // Replaces the contents with the result of a set operation between the
+  // fingerprint filters of lhs and rhs, which gives up to max_count elements.
+  // The new filter has room for max_count elements, but not fewer slots than
+  // the current ones.
+  using set_operation = void (quotient_filter_fp::*)(
+      const quotient_filter_fp &, const quotient_filter_fp &);
+  void assign_merged(const quotient_filter &lhs, const quotient_filter &rhs,
+                     size_type max_count, set_operation operation);
+
+  // Returns an empty fingerprint filter with room for max_count elements, but
+  // not fewer slots than the current ones.
+  quotient_filter_fp make_filter_for(size_type max_count) const;
+
+  // Returns a filter which uses a loaded fingerprint filter.
+  static quotient_filter from_stored(quotient_filter_fp &&stored,
+                                     const Hash &hash);
+
+  // Hashes the keys in batches and calls lookup(first, last, out) for each
+  // batch of hash values. Returns the last output iterator.
+  template <typename InputIt, typename OutputIt, typename Lookup>
+  OutputIt for_each_hash_batch(InputIt first, InputIt last, OutputIt out,
+                               Lookup lookup) const {
+    constexpr std::size_t batch_size = 256;
+    size_type hashes[batch_size];
+    while (first != last) {
+      std::size_t count = 0;
+      for (; count != batch_size && first != last; ++first)
+        hashes[count++] = hash_fn(*first);
+      out = lookup(hashes, hashes + count, out);
+    }
+    return out;
+  }
+
   static_assert(hash_bits != 0,
                 "The generated hashes must have at least one bit");
 
@@ -233,8 +510,9 @@ private:
   float max_load_factor_{0.75f};
 };
 
-template <typename Key, typename Hash, std::size_t Bits>
-void quotient_filter<Key, Hash, Bits>::max_load_factor(float ml) noexcept {
+template <typename Key, typename Hash, std::size_t Bits, slot_layout Layout>
+void quotient_filter<Key, Hash, Bits, Layout>::max_load_factor(
+    float ml) noexcept {
   assert(size() <= max_allowed_size());
 
   max_load_factor_ = std::min(std::max(ml, 0.01f), 1.0f);
@@ -245,8 +523,8 @@ void quotient_filter<Key, Hash, Bits>::max_load_factor(float ml) noexcept {
   }
 }
 
-template <typename Key, typename Hash, std::size_t Bits>
-auto quotient_filter<Key, Hash, Bits>::insert(const value_type &elem)
+template <typename Key, typename Hash, std::size_t Bits, slot_layout Layout>
+auto quotient_filter<Key, Hash, Bits, Layout>::insert(const value_type &elem)
     -> std::pair<iterator, bool> {
   assert(size() <= max_allowed_size() && "The filter is corrupted");
   const auto hash_value = hash_fn(elem);
@@ -262,8 +540,80 @@ auto quotient_filter<Key, Hash, Bits>::insert(const value_type &elem)
   return filter.insert(hash_value);
 }
 
-template <typename Key, typename Hash, std::size_t Bits>
-void quotient_filter<Key, Hash, Bits>::regenerate(size_type count) {
+template <typename Key, typename Hash, std::size_t Bits, slot_layout Layout>
+void quotient_filter<Key, Hash, Bits, Layout>::assign_merged(
+    const quotient_filter &lhs, const quotient_filter &rhs,
+    const size_type max_count, const set_operation operation) {
+  quotient_filter_fp temp = make_filter_for(max_count);
+  if (temp.capacity() != 0)
+    (temp.*operation)(lhs.filter, rhs.filter);
+  filter = std::move(temp);
+  assert(size() <= max_allowed_size());
+}
+
+template <typename Key, typename Hash, std::size_t Bits, slot_layout Layout>
+template <typename RandomIt>
+void quotient_filter<Key, Hash, Bits, Layout>::assign_parallel(
+    const RandomIt first, const RandomIt last, unsigned num_threads) {
+  num_threads = detail::thread_count(num_threads);
+  const auto n = static_cast<std::size_t>(last - first);
+
+  std::vector<size_type> hashes(n);
+  detail::run_parallel(num_threads, [&](unsigned t) {
+    const std::size_t end = detail::chunk_begin(n, num_threads, t + 1);
+    for (std::size_t i = detail::chunk_begin(n, num_threads, t); i != end; ++i)
+      hashes[i] = hash_fn(first[static_cast<std::ptrdiff_t>(i)]);
+  });
+
+  quotient_filter_fp temp = make_filter_for(n);
+  temp.assign_parallel(std::move(hashes), num_threads);
+  filter = std::move(temp);
+  assert(size() <= max_allowed_size());
+}
+
+template <typename Key, typename Hash, std::size_t Bits, slot_layout Layout>
+quotient_filter_fp
+quotient_filter<Key, Hash, Bits, Layout>::make_filter_for(
+    const size_type max_count) const {
+  const auto min_slot_count =
+      static_cast<size_type>(std::ceil(static_cast<float>(max_count) /
+                                       max_load_factor()));
+  const auto new_slot_count = std::max(min_slot_count, slot_count());
+
+  if (!new_slot_count)
+    return quotient_filter_fp();
+
+  const size_type q_bits = calc_required_q(new_slot_count);
+  if (q_bits >= hash_bits)
+    throw std::length_error("The number of bits of elements (hash values) "
+                            "contained in the filter is not enough to hold the "
+                            "required slot count.");
+
+  return quotient_filter_fp(q_bits, hash_bits - q_bits, Layout);
+}
+
+template <typename Key, typename Hash, std::size_t Bits, slot_layout Layout>
+auto quotient_filter<Key, Hash, Bits, Layout>::from_stored(
+    quotient_filter_fp &&stored, const Hash &hash) -> quotient_filter {
+  if (stored.capacity() != 0 &&
+      (stored.quotient_bits() + stored.remainder_bits() != hash_bits ||
+       stored.layout() != Layout))
+    throw bad_filter_format("The quotient filter uses another number of hash "
+                            "bits or slot layout");
+
+  quotient_filter result(0, hash);
+  result.filter = std::move(stored);
+  if (result.size() > result.max_allowed_size()) {
+    // One step above the load factor is enough to make up for its rounding.
+    const float load = std::nextafter(result.load_factor(), 2.0f);
+    result.max_load_factor_ = std::min(load, 1.0f);
+  }
+  assert(result.size() <= result.max_allowed_size());
+  return result;
+}
+
+template <typename Key, typename Hash, std::size_t Bits, slot_layout Layout>
+void quotient_filter<Key, Hash, Bits, Layout>::regenerate(size_type count) {
 
   const auto min_slot_count =
       static_cast<size_type>(std::ceil(size() / max_load_factor()));
@@ -290,13 +640,26 @@ void quotient_filter<Key, Hash, Bits>::regenerate(size_type count) {
                             "contained in the filter is not enough to hold the "
                             "required slot count.");
 
-  quotient_filter_fp temp(q_bits, r_bits);
+  if (q_bits == filter.quotient_bits() + 1 && filter.capacity() != 0) {
+    filter.expand(); // Moves one bit of the remainders to the quotients.
+    assert(count <= slot_count());
+    return;
+  }
+
+  if (q_bits + 1 == filter.quotient_bits()) {
+    filter.shrink(); // Moves one bit of the quotients to the remainders.
+    assert(count <= slot_count());
+    return;
+  }
+
+  quotient_filter_fp temp(q_bits, r_bits, Layout);
 
   assert(temp.capacity() != filter.capacity() &&
          "Regeneration should not have been required");
 
-  for (const auto hash_value : filter)
-    temp.insert(hash_value);
+  // The old filter is iterated in ascending order of hash values, so the new
+  // one can be built in a single pass.
+  temp.assign_sorted(filter.begin(), filter.end());
 
   assert(temp.size() == filter.size()); // Everything is ok.
   filter = std::move(temp);
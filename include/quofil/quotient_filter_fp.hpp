@@ -8,21 +8,114 @@
 #ifndef QUOFIL_QUOTIENT_FILTER_FP_HPP
 #define QUOFIL_QUOTIENT_FILTER_FP_HPP
 
+#include <quofil/buffer_view.hpp>
+#include <quofil/detail/word_buffer.hpp>
+
+#include <algorithm> // for std::sort
 #include <exception> // for std::exception
+#include <iosfwd>    // for std::istream, std::ostream
 #include <iterator>  // for std::forward_iterator_tag
+#include <stdexcept> // for std::runtime_error
 #include <utility>   // for std::pair
 #include <vector>    // for std::vector
 #include <cassert>   // for assert
 #include <cstddef>   // for std::size_t, std::ptrdiff_t
+#include <cstdint>   // for std::uint64_t
 
 namespace quofil {
 
+class counting_quotient_filter_fp;
+class concurrent_quotient_filter_fp;
+class mapped_quotient_filter_fp;
+
 /// \brief Exception thrown when an insertion on a full filter is attempted.
 class filter_is_full : public std::exception {
 public:
   const char *what() const noexcept override;
 };
 
+/// \brief Exception thrown when stored filter data is malformed or was written
+/// by an incompatible version.
+class bad_filter_format : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+/// \brief Describes how the slots of a quotient filter are laid out in memory.
+enum class slot_layout {
+  /// The metadata bits and the remainders are kept in separate arrays. Every
+  /// slot access touches one cache line per array.
+  separate,
+
+  /// Slots are grouped in blocks of 64 (the number of bits of a word). Each
+  /// block keeps its metadata words and its remainders contiguously and starts
+  /// at a cache line boundary, so a slot access usually touches a single cache
+  /// line.
+  blocked
+};
+
+/// \brief Bytes of memory used by a quotient filter, by component.
+struct memory_footprint {
+  /// The occupied, continuation and shifted flags and the run offsets.
+  std::size_t metadata;
+
+  /// The remainders.
+  std::size_t remainders;
+
+  /// The padding between blocks and the overhead of the allocation.
+  std::size_t slack;
+
+  /// \brief Returns the sum of all the components.
+  std::size_t total() const noexcept { return metadata + remainders + slack; }
+};
+
+/// \brief Histogram of lengths or distances measured in slots.
+struct slot_histogram {
+  /// The element \c i is the number of times the value \c i was observed.
+  std::vector<std::size_t> counts;
+
+  /// \brief Adds an observation of the given value.
+  void add(std::size_t value);
+
+  /// \brief Returns the number of observations.
+  std::size_t total() const noexcept;
+
+  /// \brief Returns the mean of the observed values, or 0 if there are none.
+  double mean() const noexcept;
+
+  /// \brief Returns the smallest value which is not exceeded by the given
+  /// fraction of the observations, or 0 if there are none.
+  ///
+  /// \pre <tt>0 <= fraction <= 1</tt>
+  std::size_t percentile(double fraction) const noexcept;
+
+  /// \brief Returns the greatest observed value, or 0 if there are none.
+  std::size_t max() const noexcept {
+    return counts.empty() ? 0 : counts.size() - 1;
+  }
+};
+
+/// \brief Shape of the slots of a quotient filter.
+///
+/// A cluster is a sequence of elements which begins at its canonical slot and
+/// continues with every element shifted by it. A span is a maximal sequence of
+/// non-empty slots, which may hold several contiguous clusters. Lookups scan
+/// back to the start of a cluster and insertions shift slots forward to the
+/// end of a span.
+struct filter_statistics {
+  /// Number of slots of each cluster.
+  slot_histogram cluster_lengths;
+
+  /// Number of slots (that is, elements) of each run.
+  slot_histogram run_lengths;
+
+  /// Distance of each element from its canonical slot.
+  slot_histogram shift_distances;
+
+  /// Number of slots of each span of non-empty slots.
+  slot_histogram span_lengths;
+};
+
 /// \brief Quotient-Filter implementation class.
 class quotient_filter_fp {
 public:
@@ -31,6 +124,9 @@ public:
   class iterator;
   using const_iterator = iterator;
   friend class iterator;
+  friend class counting_quotient_filter_fp;
+  friend class concurrent_quotient_filter_fp;
+  friend class mapped_quotient_filter_fp;
 
 public:
   /// \brief Constructs a quotient filter with zero capacity.
@@ -38,16 +134,19 @@ public:
 
   /// \brief Constructs a quotient filter using the given bits requirements.
   ///
-  /// The constructed filter will use approximately <tt>(r + 3) * pow(2, q)</tt>
-  /// bits of memory. Afterward, all inserted, searched and queried keys must
-  /// be less than <tt>1 << r + q</tt>, otherwise the behavior is undefined.
+  /// The constructed filter will use approximately <tt>(r + 4) * pow(2, q)</tt>
+  /// bits of memory, see <tt>memory_usage()</tt>. Afterward, all inserted,
+  /// searched and queried keys must be less than <tt>1 << r + q</tt>,
+  /// otherwise the behavior is undefined.
   ///
   /// \param q The number of bits for the quotient.
   /// \param r The number of bits for the remainder.
+  /// \param layout The memory layout of the slots.
   ///
   /// \pre \p r shall positive.
   ///
-  quotient_filter_fp(size_type q, size_type r);
+  quotient_filter_fp(size_type q, size_type r,
+                     slot_layout layout = slot_layout::separate);
 
   /// \brief Searchs for a given fingerprint.
   ///
@@ -61,6 +160,36 @@ public:
   /// Effectively returns 0 or 1.
   size_type count(value_type fp) const noexcept;
 
+  /// \brief Counts a sequence of fingerprints.
+  ///
+  /// Equivalent to calling <tt>count()</tt> for each fingerprint, but the
+  /// slots of the following fingerprints are prefetched meanwhile, so the
+  /// memory accesses of several lookups overlap.
+  ///
+  /// \param first Beginning of the fingerprints.
+  /// \param last End of the fingerprints.
+  /// \param out Beginning of the destination of the counts. It could be, for
+  /// example, a bitmap such as <tt>std::vector<bool></tt>.
+  ///
+  /// \returns Output iterator to the element past the last count written.
+  ///
+  template <typename ForwardIt, typename OutputIt>
+  OutputIt count_many(ForwardIt first, ForwardIt last, OutputIt out) const;
+
+  /// \brief Searchs for a sequence of fingerprints.
+  ///
+  /// Equivalent to calling <tt>find()</tt> for each fingerprint, but the slots
+  /// of the following fingerprints are prefetched meanwhile.
+  ///
+  /// \param first Beginning of the fingerprints.
+  /// \param last End of the fingerprints.
+  /// \param out Beginning of the destination of the iterators.
+  ///
+  /// \returns Output iterator to the element past the last iterator written.
+  ///
+  template <typename ForwardIt, typename OutputIt>
+  OutputIt find_many(ForwardIt first, ForwardIt last, OutputIt out) const;
+
   /// \brief Inserts the given fingerprint into the filter.
   ///
   /// If the insertion took place, all iterators become invalidate.
@@ -90,9 +219,165 @@ public:
   /// \returns The number of erased elements, effectively 0 or 1.
   size_type erase(value_type fp) noexcept;
 
+  /// \brief Replaces the contents with the fingerprints of a sorted range.
+  ///
+  /// The filter is built in a single pass over the slots, without shifting
+  /// clusters, so it takes linear time. Repeated fingerprints are inserted
+  /// once. All iterators are invalidated.
+  ///
+  /// \param first Beginning of the range.
+  /// \param last End of the range.
+  ///
+  /// \pre The range shall be sorted in ascending order.
+  ///
+  /// \throws filter_is_full if the range has more than <tt>capacity()</tt>
+  /// distinct fingerprints. In such case the filter is left empty.
+  ///
+  template <typename InputIt> void assign_sorted(InputIt first, InputIt last);
+
+  /// \brief Replaces the contents with the fingerprints of a range.
+  ///
+  /// Sorts a copy of the range and calls <tt>assign_sorted()</tt>.
+  ///
+  /// \param first Beginning of the range.
+  /// \param last End of the range.
+  ///
+  /// \throws filter_is_full if the range has more than <tt>capacity()</tt>
+  /// distinct fingerprints. In such case the filter is left empty.
+  ///
+  template <typename InputIt> void assign(InputIt first, InputIt last);
+
+  /// \brief Replaces the contents with the given fingerprints, using several
+  /// threads.
+  ///
+  /// The fingerprints are partitioned by the highest bits of their quotients,
+  /// so that each partition maps to a range of whole blocks of slots. The
+  /// partitions are sorted and written independently. The fingerprints whose
+  /// clusters overflow their range are inserted at the end by a single thread.
+  /// Repeated fingerprints are inserted once. All iterators are invalidated.
+  ///
+  /// \param fingerprints The fingerprints to be inserted. They are consumed
+  /// as scratch space.
+  /// \param num_threads The number of threads to be used. Zero means one per
+  /// hardware thread.
+  ///
+  /// \throws filter_is_full if there are more than <tt>capacity()</tt>
+  /// distinct fingerprints. In such case the filter is left empty.
+  ///
+  void assign_parallel(std::vector<value_type> fingerprints,
+                       unsigned num_threads = 0);
+
+  /// \brief Replaces the contents with the union of two filters.
+  ///
+  /// Both filters are merged in a single pass over their ordered elements,
+  /// so it takes linear time. The quotient and remainder bits of \c *this are
+  /// kept. All iterators of \c *this are invalidated.
+  ///
+  /// \param lhs The first filter. It could be \c *this.
+  /// \param rhs The second filter. It could be \c *this.
+  ///
+  /// \pre Each filter shall be empty or use fingerprints of
+  /// <tt>quotient_bits() + remainder_bits()</tt> bits, like \c *this.
+  ///
+  /// \throws filter_is_full if the union has more than <tt>capacity()</tt>
+  /// fingerprints. In such case \c *this is not modified.
+  ///
+  void assign_union(const quotient_filter_fp &lhs,
+                    const quotient_filter_fp &rhs);
+
+  /// \brief Replaces the contents with the fingerprints contained in both
+  /// filters.
+  ///
+  /// Same as <tt>assign_union()</tt> but keeps only the common fingerprints.
+  ///
+  void assign_intersection(const quotient_filter_fp &lhs,
+                           const quotient_filter_fp &rhs);
+
+  /// \brief Replaces the contents with the fingerprints of \p lhs which are
+  /// not contained in \p rhs.
+  ///
+  /// Same as <tt>assign_union()</tt> but keeps only the fingerprints which are
+  /// exclusive to \p lhs.
+  ///
+  void assign_difference(const quotient_filter_fp &lhs,
+                         const quotient_filter_fp &rhs);
+
+  /// \brief Doubles the capacity keeping the contents.
+  ///
+  /// The most significant bit of the remainders becomes the least significant
+  /// bit of the quotients, so the fingerprints do not change. The memory is
+  /// grown in place when the allocator can extend it, and the slots are
+  /// redistributed inside it in a single pass, so the peak memory is about
+  /// the size of the expanded filter. All iterators are invalidated.
+  ///
+  /// \pre <tt>remainder_bits() > 1</tt>
+  ///
+  /// \throws std::bad_alloc if the memory cannot be grown. If it is thrown
+  /// once the slots are being redistributed, the filter is left empty.
+  ///
+  void expand();
+
+  /// \brief Halves the capacity keeping the contents.
+  ///
+  /// The least significant bit of the quotients becomes the most significant
+  /// bit of the remainders, so the fingerprints do not change. The new slots
+  /// are written in a single pass over the current ones. All iterators are
+  /// invalidated.
+  ///
+  /// \pre <tt>quotient_bits() > 0</tt>
+  ///
+  /// \throws filter_is_full if <tt>size() > capacity() / 2</tt>. In such case
+  /// the filter is not modified.
+  ///
+  void shrink();
+
   /// \brief Clears the contents.
   void clear() noexcept;
 
+  /// \brief Writes the filter to a binary stream.
+  ///
+  /// The format is a 64-byte header, holding the quotient and remainder bits,
+  /// the slot layout, the number of elements, a format version and
+  /// \p hash_tag, followed by the slots as they are laid out in memory. Every
+  /// field uses the byte order of the machine. The same format is used by
+  /// mapped_quotient_filter_fp files.
+  ///
+  /// Errors are reported through the state of \p os.
+  ///
+  /// \param os The stream, which should be opened in binary mode.
+  /// \param hash_tag An identifier of the function which computed the
+  /// fingerprints. Loading the filter requires the same tag.
+  ///
+  void save(std::ostream &os, std::uint64_t hash_tag) const;
+
+  /// \brief Reads a filter written by <tt>save()</tt>.
+  ///
+  /// \param is The stream, which should be opened in binary mode.
+  /// \param hash_tag The tag given to <tt>save()</tt>.
+  ///
+  /// \throws bad_filter_format if the stream ends early, does not hold a
+  /// filter which can be used on this machine or has another hash tag.
+  ///
+  static quotient_filter_fp load(std::istream &is, std::uint64_t hash_tag);
+
+  /// \brief Returns a read-only view of the filter stored in a buffer
+  /// written by <tt>save()</tt>, which uses its slots without copying them.
+  ///
+  /// It takes constant time, so a mapped file can be queried right away. The
+  /// buffer is never written, so it can be mapped read-only.
+  ///
+  /// \param data The beginning of the buffer. It shall be aligned as
+  /// \c value_type and must outlive the returned view.
+  /// \param size The size of the buffer in bytes. It may be larger than the
+  /// stored filter.
+  /// \param hash_tag The tag given to <tt>save()</tt>.
+  ///
+  /// \throws bad_filter_format if the buffer does not hold a filter which can
+  /// be used on this machine or has another hash tag.
+  ///
+  static buffer_view<quotient_filter_fp>
+  view_from_buffer(const void *data, size_type size, std::uint64_t hash_tag);
+
   /// \brief Returns the number of elements in the quotient filter.
   size_type size() const noexcept { return num_elements; }
 
@@ -113,6 +398,27 @@ public:
   /// \brief Returns the number of bits used for the remainder.
   size_type remainder_bits() const noexcept { return r_bits; }
 
+  /// \brief Returns the memory layout of the slots.
+  slot_layout layout() const noexcept { return layout_; }
+
+  /// \brief Returns the bytes of memory used by the slots, by component.
+  ///
+  /// The slots use <tt>r + 4</tt> bits each, plus the padding of the blocked
+  /// layout. The slack also counts the extra bytes taken to align the
+  /// allocation, unless the slots live in external memory. The filter object
+  /// itself is not counted.
+  memory_footprint memory_usage() const noexcept;
+
+  /// \brief Returns the bits of memory used per element, or 0 if the filter
+  /// is empty.
+  double bits_per_element() const noexcept;
+
+  /// \brief Measures the clusters, runs and spans of the filter.
+  ///
+  /// Takes a single pass over the slots. Clusters and spans which wrap around
+  /// the end of the filter are measured as a whole.
+  filter_statistics statistics() const;
+
   /// \brief Returns an iterator to the beginning of the filter.
   const_iterator begin() const noexcept;
 
@@ -120,9 +426,41 @@ public:
   const_iterator end() const noexcept;
 
 private:
+  enum meta_word : std::size_t {
+    occupied_word,
+    continuation_word,
+    shifted_word,
+    offset_word, // Number of runs pending at the beginning of the block.
+    meta_words_per_block
+  };
+
+  value_type &meta(meta_word, size_type) noexcept;
+  const value_type &meta(meta_word, size_type) const noexcept;
+  bool get_flag(meta_word, size_type) const noexcept;
+  void set_flag(meta_word, size_type, bool) noexcept;
+  bool exchange_flag(meta_word, size_type, bool) noexcept;
+
+  bool is_occupied(size_type pos) const noexcept {
+    return get_flag(occupied_word, pos);
+  }
+  bool is_continuation(size_type pos) const noexcept {
+    return get_flag(continuation_word, pos);
+  }
+  bool is_shifted(size_type pos) const noexcept {
+    return get_flag(shifted_word, pos);
+  }
+
+  value_type *remainders(size_type) noexcept;
+  const value_type *remainders(size_type) const noexcept;
+
   value_type get_remainder(size_type) const noexcept;
   void set_remainder(size_type, value_type) noexcept;
-  value_type exchange_remainder(size_type, value_type) noexcept;
+
+  void move_slots_up(size_type, size_type) noexcept;
+  void move_slots_down(size_type, size_type) noexcept;
+  void shift_slots_right(size_type, size_type) noexcept;
+  void shift_slots_left(size_type, size_type) noexcept;
+  void set_flags(meta_word, size_type, size_type) noexcept;
 
   size_type incr_pos(size_type) const noexcept;
   size_type decr_pos(size_type) const noexcept;
@@ -132,13 +470,47 @@ private:
 
   size_type find_next_occupied(size_type) const noexcept;
   size_type find_next_run_quotient(size_type) const noexcept;
+  size_type find_next_empty(size_type) const noexcept;
+  size_type find_cluster_start(size_type) const noexcept;
+  size_type find_next_run_start(size_type) const noexcept;
   size_type find_run_start(size_type) const noexcept;
-
-  void insert_into(size_type, value_type, bool) noexcept;
+  size_type select_run_start(size_type, size_type) const noexcept;
+  size_type find_new_run_start(size_type) const noexcept;
+  size_type walk_to_run_start(size_type) const noexcept;
+  size_type run_length(size_type) const noexcept;
+  size_type lower_bound_in_run(size_type, size_type, value_type) const
+      noexcept;
+
+  value_type run_starts(size_type) const noexcept;
+  value_type empty_slots(size_type) const noexcept;
+  void update_offsets(size_type, size_type) noexcept;
+  void rebuild_offsets() noexcept;
+
+  size_type insert_into(size_type, value_type, bool) noexcept;
+  void insert_slot(size_type, size_type, size_type, value_type, bool) noexcept;
   void remove_entry(size_type, size_type) noexcept;
 
   bool is_empty_slot(size_type) const noexcept;
 
+  void prefetch(value_type) const noexcept;
+
+  template <typename ForwardIt, typename OutputIt, typename Lookup>
+  OutputIt lookup_many(ForwardIt, ForwardIt, OutputIt, Lookup) const;
+
+  enum merge_keep : unsigned {
+    keep_lhs_only = 1, // Elements which are only in the first filter.
+    keep_rhs_only = 2, // Elements which are only in the second filter.
+    keep_common = 4    // Elements which are in both filters.
+  };
+  void assign_merged(const quotient_filter_fp &, const quotient_filter_fp &,
+                     unsigned);
+
+  class sorted_builder;
+
+  quotient_filter_fp(size_type, size_type, slot_layout, bool);
+  size_type storage_words() const noexcept;
+  static quotient_filter_fp from_header(const void *, std::uint64_t);
+
 private:
   size_type q_bits = 0;
   size_type r_bits = 0;
@@ -146,10 +518,15 @@ private:
   size_type num_elements = 0;
   value_type quotient_mask = 0;
   value_type remainder_mask = 0;
-  std::vector<bool> is_occupied;
-  std::vector<bool> is_continuation;
-  std::vector<bool> is_shifted;
-  std::vector<value_type> data;
+  slot_layout layout_ = slot_layout::separate;
+
+  // Every block of slots has one word per meta_word and r_bits words of
+  // remainders. The layout determines where those words live in 'words'.
+  size_type block_stride = 0;      // Between the metadata of two blocks.
+  size_type meta_stride = 0;       // Between two metadata words of a block.
+  size_type remainders_base = 0;   // Where the remainders of block 0 start.
+  size_type remainders_stride = 0; // Between the remainders of two blocks.
+  detail::word_buffer<value_type> words;
 };
 
 /// \brief Iterator to navigate through the elements of a quotient filter.
@@ -165,6 +542,8 @@ public:
   using iterator_category = std::forward_iterator_tag;
 
 public:
+  iterator() = default;
+
   iterator &operator++() {
     increment();
     return *this;
@@ -211,6 +590,86 @@ private:
   size_type canonical_pos = 0; // Where the remainder should be.
 };
 
+// Fills a cleared filter with fingerprints given in ascending order.
+class quotient_filter_fp::sorted_builder {
+  using size_type = quotient_filter_fp::size_type;
+  using value_type = quotient_filter_fp::value_type;
+
+public:
+  explicit sorted_builder(quotient_filter_fp &filter_) noexcept;
+  sorted_builder(quotient_filter_fp &filter_, size_type first_slot,
+                 size_type last_slot) noexcept;
+
+  void push(value_type fp);
+  size_type next_slot(value_type fp) const noexcept;
+  void finish();
+  void commit() noexcept;
+  void insert_overflow();
+
+private:
+  quotient_filter_fp *filter = nullptr;
+  size_type next_pos = 0;           // The first slot which is still empty.
+  size_type end_pos = 0;            // One past the last writable slot.
+  size_type num_written = 0;        // Fingerprints written to the slots.
+  value_type last_fp = 0;           // The last pushed fingerprint.
+  std::vector<value_type> overflow; // Fingerprints which did not fit.
+};
+
+template <typename ForwardIt, typename OutputIt>
+OutputIt quotient_filter_fp::count_many(const ForwardIt first,
+                                        const ForwardIt last,
+                                        const OutputIt out) const {
+  return lookup_many(first, last, out,
+                     [this](value_type fp) { return count(fp); });
+}
+
+template <typename ForwardIt, typename OutputIt>
+OutputIt quotient_filter_fp::find_many(const ForwardIt first,
+                                       const ForwardIt last,
+                                       const OutputIt out) const {
+  return lookup_many(first, last, out,
+                     [this](value_type fp) { return find(fp); });
+}
+
+// Looks up the fingerprints while the slots of the fingerprints located
+// 'prefetch_distance' positions ahead are being prefetched.
+template <typename ForwardIt, typename OutputIt, typename Lookup>
+OutputIt quotient_filter_fp::lookup_many(ForwardIt first, const ForwardIt last,
+                                         OutputIt out, Lookup lookup) const {
+  constexpr size_type prefetch_distance = 16;
+
+  ForwardIt ahead = first;
+  for (size_type i = 0; i != prefetch_distance && ahead != last; ++i, ++ahead)
+    prefetch(*ahead);
+
+  for (; first != last; ++first) {
+    if (ahead != last)
+      prefetch(*ahead++);
+    *out++ = lookup(*first);
+  }
+  return out;
+}
+
+template <typename InputIt>
+void quotient_filter_fp::assign_sorted(InputIt first, const InputIt last) {
+  sorted_builder builder(*this);
+  try {
+    for (; first != last; ++first)
+      builder.push(*first);
+    builder.finish();
+  } catch (...) {
+    clear();
+    throw;
+  }
+}
+
+template <typename InputIt>
+void quotient_filter_fp::assign(const InputIt first, const InputIt last) {
+  std::vector<value_type> fingerprints(first, last);
+  std::sort(fingerprints.begin(), fingerprints.end());
+  assign_sorted(fingerprints.begin(), fingerprints.end());
+}
+
 inline auto quotient_filter_fp::end() const noexcept -> iterator {
   return iterator(this, num_slots, num_slots);
 }
@@ -232,6 +691,45 @@ inline auto quotient_filter_fp::erase(value_type fp) noexcept -> size_type {
   return 1;
 }
 
+/// \brief Returns the union of two filters.
+///
+/// The filters are merged in linear time. The result has the layout of \p lhs
+/// and enough slots for the elements of both filters, but not fewer than any
+/// of them. Its fingerprints have the same number of bits as the ones of
+/// \p lhs and \p rhs.
+///
+/// \pre If both filters have a non-zero capacity, they shall use fingerprints
+/// of the same number of bits.
+///
+/// \throws filter_is_full if the fingerprints have too few bits to address
+/// enough slots.
+///
+quotient_filter_fp union_of(const quotient_filter_fp &lhs,
+                            const quotient_filter_fp &rhs);
+
+/// \brief Returns a filter with the fingerprints contained in both filters.
+///
+/// The filters are merged in linear time. The result has the layout and the
+/// quotient and remainder bits of \p lhs.
+///
+/// \pre If both filters have a non-zero capacity, they shall use fingerprints
+/// of the same number of bits.
+///
+quotient_filter_fp intersection_of(const quotient_filter_fp &lhs,
+                                   const quotient_filter_fp &rhs);
+
+/// \brief Returns a filter with the fingerprints of \p lhs which are not
+/// contained in \p rhs.
+///
+/// The filters are merged in linear time. The result has the layout and the
+/// quotient and remainder bits of \p lhs.
+///
+/// \pre If both filters have a non-zero capacity, they shall use fingerprints
+/// of the same number of bits.
+///
+quotient_filter_fp difference_of(const quotient_filter_fp &lhs,
+                                 const quotient_filter_fp &rhs);
+
 } // end namespace quofil
 
 #endif // Header guard
@@ -0,0 +1,242 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+/// \file
+/// \brief Defines the sharded_quotient_filter class.
+
+#ifndef QUOFIL_SHARDED_QUOTIENT_FILTER_HPP
+#define QUOFIL_SHARDED_QUOTIENT_FILTER_HPP
+
+#include <quofil/quotient_filter.hpp> // for quofil::quotient_filter
+#include <quofil/detail/cache_aligned_allocator.hpp>
+
+#include <algorithm>  // for std::for_each
+#include <functional> // for std::hash
+#include <limits>     // for std::numeric_limits
+#include <mutex>      // for std::{mutex, lock_guard}
+#include <vector>     // for std::vector
+#include <cstddef>    // for std::size_t
+
+namespace quofil {
+
+namespace detail {
+// Hash function of the shards, which receive hash values.
+struct identity_hash {
+  std::size_t operator()(std::size_t value) const noexcept { return value; }
+};
+
+// Returns the minimal number of bits required to index n elements.
+constexpr std::size_t index_bits(std::size_t n) noexcept {
+  return n <= 1 ? 0 : 1 + index_bits((n + 1) / 2);
+}
+} // end namespace detail
+
+/// \brief Quotient filter split into independent shards which can be accessed
+/// concurrently.
+///
+/// Each key is routed to a shard by the highest bits of its hash value. Every
+/// shard is a quotient filter with its own lock, which grows independently of
+/// the others, so threads working on different shards do not contend.
+///
+/// All member functions are thread-safe. The functions which aggregate the
+/// shards (such as <tt>size()</tt>) lock them one at a time, so they do not
+/// give a consistent snapshot while other threads modify the filter.
+///
+/// \tparam Shards The number of shards. It must be a power of two.
+///
+template <typename Key, typename Hash = std::hash<Key>,
+          std::size_t Shards = 16,
+          std::size_t Bits = std::numeric_limits<std::size_t>::digits>
+class sharded_quotient_filter {
+public:
+  static constexpr std::size_t shard_count = Shards;
+  static constexpr std::size_t hash_bits = Bits;
+  static constexpr std::size_t shard_bits = detail::index_bits(Shards);
+
+  static_assert(Shards != 0 && (Shards & (Shards - 1)) == 0,
+                "The number of shards must be a power of two");
+  static_assert(shard_bits < hash_bits,
+                "The hash values must have more bits than the shard index");
+
+  using shard_type = quotient_filter<std::size_t, detail::identity_hash,
+                                     hash_bits - shard_bits>;
+
+  using key_type = Key;
+  using value_type = Key;
+  using size_type = typename shard_type::size_type;
+  using hasher = Hash;
+
+public:
+  /// \brief Constructs an empty filter.
+  ///
+  /// \param slot_count The minimal number of slots to be allocated, evenly
+  /// distributed among the shards.
+  /// \param hash The hash function to be used.
+  ///
+  explicit sharded_quotient_filter(size_type slot_count = 0,
+                                   const Hash &hash = Hash())
+      : shards(Shards), hash_fn(hash) {
+    const size_type shard_slots = (slot_count + Shards - 1) / Shards;
+    for (auto &s : shards)
+      s.filter.regenerate(shard_slots);
+  }
+
+  sharded_quotient_filter(const sharded_quotient_filter &) = delete;
+  sharded_quotient_filter &operator=(const sharded_quotient_filter &) = delete;
+
+  /// \brief Inserts the given key.
+  ///
+  /// \returns Whether the insertion took place, i.e. whether the hash value
+  /// of the key was not contained yet.
+  bool insert(const key_type &key) {
+    const std::size_t hash_value = hash_fn(key);
+    auto &s = shards[shard_index(hash_value)];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.filter.insert(local_hash(hash_value)).second;
+  }
+
+  template <typename InputIt>
+  void insert(InputIt first, InputIt last) {
+    std::for_each(first, last, [this](const key_type &key) { insert(key); });
+  }
+
+  /// \brief Erases the hash value of the given key.
+  ///
+  /// \returns The number of erased elements, effectively 0 or 1.
+  size_type erase(const key_type &key) {
+    const std::size_t hash_value = hash_fn(key);
+    auto &s = shards[shard_index(hash_value)];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.filter.erase(local_hash(hash_value));
+  }
+
+  /// \brief Counts the elements (hash values) which match the given key,
+  /// effectively 0 or 1.
+  size_type count(const key_type &key) const {
+    const std::size_t hash_value = hash_fn(key);
+    const auto &s = shards[shard_index(hash_value)];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.filter.count(local_hash(hash_value));
+  }
+
+  /// \brief Removes all the elements.
+  void clear() {
+    for (auto &s : shards) {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      s.filter.clear();
+    }
+  }
+
+  /// \brief Returns the number of elements (hash values) of all shards.
+  size_type size() const {
+    return accumulate([](const shard_type &f) { return f.size(); });
+  }
+
+  /// \brief Checks whether every shard is empty.
+  bool empty() const { return size() == 0; }
+
+  /// \brief Returns the number of slots of all shards.
+  size_type slot_count() const {
+    return accumulate([](const shard_type &f) { return f.slot_count(); });
+  }
+
+  /// \brief Returns the ratio between the elements and the slots of all
+  /// shards.
+  float load_factor() const {
+    size_type elements = 0;
+    size_type slots = 0;
+    for (const auto &s : shards) {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      elements += s.filter.size();
+      slots += s.filter.slot_count();
+    }
+    return slots == 0 ? 0.0f : float(elements) / float(slots);
+  }
+
+  /// \brief Sets the maximum load factor of every shard.
+  void max_load_factor(float ml) {
+    for (auto &s : shards) {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      s.filter.max_load_factor(ml);
+    }
+  }
+
+  /// \brief Returns the maximum load factor of the shards.
+  float max_load_factor() const {
+    std::lock_guard<std::mutex> lock(shards[0].mutex);
+    return shards[0].filter.max_load_factor();
+  }
+
+  /// \brief Reserves space for at least the specified number of elements,
+  /// assuming they are evenly distributed among the shards.
+  void reserve(size_type count) {
+    const size_type per_shard = (count + Shards - 1) / Shards;
+    for (auto &s : shards) {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      s.filter.reserve(per_shard);
+    }
+  }
+
+  /// \brief Calls \p f with each element (hash value), in ascending order.
+  ///
+  /// Each shard is locked while it is visited, so \p f must not access the
+  /// filter.
+  template <typename Function>
+  void for_each(Function f) const {
+    for (std::size_t i = 0; i != Shards; ++i) {
+      std::lock_guard<std::mutex> lock(shards[i].mutex);
+      const std::size_t high_bits =
+          shard_bits == 0 ? 0 : i << (hash_bits - shard_bits);
+      for (const std::size_t local : shards[i].filter)
+        f(high_bits | local);
+    }
+  }
+
+  // Observers
+  hasher hash_function() const { return hash_fn; }
+
+private:
+  // Returns the shard of the given hash value, given by the highest of its
+  // hash_bits bits. The hasher could return wider values.
+  static std::size_t shard_index(std::size_t hash_value) noexcept {
+    constexpr std::size_t digits = std::numeric_limits<std::size_t>::digits;
+    const std::size_t masked = hash_value & (~std::size_t{0} >>
+                                             (digits - hash_bits));
+    return shard_bits == 0 ? 0 : masked >> (hash_bits - shard_bits);
+  }
+
+  // Returns the bits of the hash value which are stored in its shard.
+  static std::size_t local_hash(std::size_t hash_value) noexcept {
+    constexpr std::size_t local_bits = hash_bits - shard_bits;
+    constexpr std::size_t digits = std::numeric_limits<std::size_t>::digits;
+    return hash_value & (~std::size_t{0} >> (digits - local_bits));
+  }
+
+  // Returns the sum of f(filter) over the shards.
+  template <typename Function>
+  size_type accumulate(Function f) const {
+    size_type total = 0;
+    for (const auto &s : shards) {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      total += f(s.filter);
+    }
+    return total;
+  }
+
+private:
+  // Each shard takes whole cache lines, so threads working on neighbouring
+  // shards do not share them. The shards are allocated at a cache line
+  // boundary, since operator new ignores the alignment of the type.
+  struct alignas(64) shard {
+    mutable std::mutex mutex;
+    shard_type filter;
+  };
+
+  std::vector<shard, detail::cache_aligned_allocator<shard>> shards;
+  Hash hash_fn;
+};
+
+} // End namespace quofil
+
+#endif // Header guard
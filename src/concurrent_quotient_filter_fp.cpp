@@ -0,0 +1,416 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <quofil/concurrent_quotient_filter_fp.hpp>
+#include <quofil/detail/relaxed_word.hpp>
+#include <algorithm> // for std::min, std::max
+#include <limits>    // for std::numeric_limits
+#include <cassert>   // for assert
+
+// ==========================================
+// General declarations.
+// ==========================================
+
+using cfilter = ::quofil::concurrent_quotient_filter_fp;
+using qfilter = ::quofil::quotient_filter_fp;
+using size_type = cfilter::size_type;
+using value_type = cfilter::value_type;
+using quofil::detail::load_relaxed;
+
+static constexpr size_type bits_per_block =
+    std::numeric_limits<value_type>::digits;
+
+// A region holds at least one block.
+static constexpr size_type min_region_bits = 6;
+static_assert(size_type{1} << min_region_bits == bits_per_block,
+              "min_region_bits must give the number of slots of a block");
+
+// Readers copy up to this many blocks into a snapshot. Longer runs are
+// searched under the locks. Since q >= 8 leaves at most 56 remainder bits, a
+// block never takes more than 4 metadata words plus 64 remainder words.
+static constexpr size_type max_snapshot_blocks = 4;
+static constexpr size_type max_snapshot_words =
+    max_snapshot_blocks * (4 + bits_per_block);
+
+// Readers which fail this many times, because writers keep modifying the
+// blocks, search under the locks as well. It must match the documentation of
+// count().
+static constexpr size_type max_lookup_attempts = 8;
+
+// ==========================================
+// Lock regions
+// ==========================================
+
+// Writers lock regions with a mutex each. Besides, every block has a version
+// counter which lets the readers detect modifications, as in a sequence lock:
+// it becomes odd when a writer starts modifying the block and even again when
+// it finishes.
+
+// Locks the regions spanned by the cluster from canonical_pos on: from the
+// region of canonical_pos to the one holding the next empty slot. They contain
+// every slot read or written by the operations on the run of canonical_pos,
+// given that no cluster wraps around up to its own block.
+//
+// The regions are always acquired in ascending order of index, so writers do
+// not deadlock. When the locked range must grow past the last region, all the
+// regions are released and taken again in order.
+class cfilter::region_lock {
+public:
+  region_lock(const cfilter &, size_type);
+  region_lock(const region_lock &) = delete;
+  region_lock &operator=(const region_lock &) = delete;
+  ~region_lock();
+
+  // Must be called before modifying the cluster. It marks the blocks from the
+  // canonical slot to the next empty slot as being modified.
+  void begin_write() noexcept;
+
+private:
+  std::mutex &mutex(size_type i) const noexcept {
+    return owner.regions[(first + i) % owner.num_regions];
+  }
+  void bump_versions(std::memory_order) const noexcept;
+  void lock_all();
+  void unlock_all() noexcept;
+
+private:
+  const cfilter &owner;
+  size_type canonical_pos;
+  size_type first; // The region of the canonical slot.
+  size_type count; // The number of locked regions.
+  size_type written_blocks = 0;
+};
+
+cfilter::region_lock::region_lock(const cfilter &owner_,
+                                  const size_type canonical_pos_)
+    : owner(owner_), canonical_pos{canonical_pos_},
+      first{owner_.region_of(canonical_pos_)},
+      count{std::min<size_type>(2, owner_.num_regions)} {
+  lock_all();
+  while (count != owner.num_regions &&
+         !owner.has_empty_slot(canonical_pos, count)) {
+    if (first + count < owner.num_regions) {
+      mutex(count).lock(); // The next region has a greater index.
+      ++count;
+    } else {
+      unlock_all();
+      ++count;
+      lock_all();
+    }
+  }
+}
+
+cfilter::region_lock::~region_lock() {
+  bump_versions(std::memory_order_release);
+  unlock_all();
+}
+
+void cfilter::region_lock::begin_write() noexcept {
+  if (written_blocks != 0)
+    return;
+  // Insertions fill the next empty slot and erasures do not reach it. The
+  // offsets which change are those of the blocks in between.
+  const size_type num_blocks = owner.capacity() / bits_per_block;
+  const size_type first_block = canonical_pos / bits_per_block;
+  const size_type last_block =
+      owner.filter.find_next_empty(canonical_pos) / bits_per_block;
+  written_blocks = (last_block + num_blocks - first_block) % num_blocks + 1;
+
+  bump_versions(std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+// Increments the versions of the written blocks, if any.
+void cfilter::region_lock::bump_versions(const std::memory_order order) const
+    noexcept {
+  const size_type num_blocks = owner.capacity() / bits_per_block;
+  size_type block = canonical_pos / bits_per_block;
+  for (size_type i = 0; i != written_blocks; ++i) {
+    auto &version = owner.versions[block];
+    version.store(version.load(std::memory_order_relaxed) + 1, order);
+    block = (block + 1) % num_blocks;
+  }
+}
+
+void cfilter::region_lock::lock_all() {
+  // If the range wraps around, its last regions have the lowest indices.
+  const size_type num_regions = owner.num_regions;
+  const size_type wrapped =
+      first + count > num_regions ? first + count - num_regions : 0;
+  for (size_type i = 0; i != wrapped; ++i)
+    owner.regions[i].lock();
+  for (size_type i = first; i != first + count - wrapped; ++i)
+    owner.regions[i].lock();
+}
+
+void cfilter::region_lock::unlock_all() noexcept {
+  for (size_type i = 0; i != count; ++i)
+    mutex(i).unlock();
+}
+
+// ==========================================
+// Member functions
+// ==========================================
+
+cfilter::concurrent_quotient_filter_fp(const size_type q, const size_type r,
+                                       const size_type region_bits,
+                                       const slot_layout layout)
+    : filter(q, r, layout),
+      region_shift{std::min(std::max(region_bits, min_region_bits), q)},
+      num_regions{size_type{1} << (q - region_shift)},
+      regions{std::make_unique<std::mutex[]>(num_regions)},
+      versions{std::make_unique<std::atomic<std::uint32_t>[]>(
+          capacity() / bits_per_block)} {
+  assert(q >= 8 && "The filter must have at least 256 slots");
+}
+
+cfilter::~concurrent_quotient_filter_fp() = default;
+
+size_type cfilter::max_size() const noexcept {
+  return capacity() - 2 * bits_per_block;
+}
+
+size_type cfilter::canonical_pos(const value_type fp) const noexcept {
+  return static_cast<size_type>(filter.extract_quotient(fp));
+}
+
+// Checks whether there is an empty slot at or after pos within the 'count'
+// regions which begin at the region of pos. Nothing else is read.
+bool cfilter::has_empty_slot(const size_type pos, const size_type count) const
+    noexcept {
+  assert(count < num_regions);
+  const size_type num_blocks = capacity() / bits_per_block;
+  const size_type blocks_per_region = region_slots() / bits_per_block;
+  const size_type end_block =
+      (region_of(pos) + count) * blocks_per_region % num_blocks;
+
+  size_type block = pos / bits_per_block;
+  value_type empty =
+      filter.empty_slots(block) & (~value_type{0} << pos % bits_per_block);
+  while (empty == 0) {
+    block = (block + 1) % num_blocks;
+    if (block == end_block)
+      return false;
+    empty = filter.empty_slots(block);
+  }
+  return true;
+}
+
+// Searches the fingerprint whose canonical slot is pos in the given filter,
+// which is a snapshot of the blocks around pos. The search reads nothing past
+// the slot pos + span, where span is the distance from pos to the end of its
+// run. If span reaches 'limit', the search is abandoned and returns false.
+bool cfilter::lookup(const qfilter &snapshot, const size_type pos,
+                     const value_type remainder, const size_type limit,
+                     size_type &span) noexcept {
+  const size_type num_slots = snapshot.capacity();
+  const size_type mask = num_slots - 1;
+
+  span = 0;
+  if (!snapshot.is_occupied(pos))
+    return false;
+
+  size_type run_start = pos;
+  if (snapshot.is_shifted(pos)) {
+    run_start = snapshot.select_run_start(pos, num_slots / bits_per_block);
+    if (run_start == num_slots) {
+      span = limit;
+      return false;
+    }
+  }
+
+  // A run which goes past the end of the snapshot wraps around to its first
+  // block, so its span is at least 'limit' anyway.
+  const size_type length = snapshot.run_length(run_start);
+  span = ((run_start - pos) & mask) + length;
+  if (span >= limit)
+    return false;
+
+  const size_type offset =
+      snapshot.lower_bound_in_run(run_start, length, remainder);
+  return offset != length &&
+         snapshot.get_remainder((run_start + offset) & mask) == remainder;
+}
+
+// Copies the blocks of the filter which begin at first_block into the given
+// snapshot, whose block i receives the block first_block + i. A writer could
+// be modifying them, but the words are loaded and stored by the writers with
+// relaxed atomic accesses (see relaxed_word.hpp), so a torn copy is only
+// inconsistent and is discarded by the version check.
+void cfilter::copy_blocks(qfilter &snapshot, const size_type first_block) const
+    noexcept {
+  const size_type num_blocks = capacity() / bits_per_block;
+  const size_type r = remainder_bits();
+  const qfilter::meta_word kinds[] = {
+      qfilter::occupied_word, qfilter::continuation_word,
+      qfilter::shifted_word, qfilter::offset_word};
+
+  for (size_type i = 0; i != snapshot.capacity() / bits_per_block; ++i) {
+    const size_type block = (first_block + i) % num_blocks;
+    for (const auto kind : kinds)
+      snapshot.meta(kind, i) = load_relaxed(filter.meta(kind, block));
+    const value_type *const src = filter.remainders(block);
+    value_type *const dest = snapshot.remainders(i);
+    for (size_type j = 0; j != r; ++j)
+      dest[j] = load_relaxed(src[j]);
+  }
+}
+
+// Searches fp without locking, reading only the 'window' blocks which begin at
+// the block of its canonical slot. Their versions are taken before copying
+// them into a snapshot and checked after it. Returns false if any of them
+// changed, in which case 'found' is meaningless. If the run goes beyond the
+// window, it is doubled.
+//
+// The versions only increase, so they are unchanged if their sum is. The
+// search runs on the snapshot once it is known to be consistent.
+bool cfilter::try_lookup(const value_type fp, size_type &window,
+                         bool &found) const noexcept {
+  assert(window <= max_snapshot_blocks);
+  const size_type num_blocks = capacity() / bits_per_block;
+  const size_type pos = canonical_pos(fp);
+  const size_type first_block = pos / bits_per_block;
+
+  const auto sum_versions = [&](std::memory_order order) {
+    std::uint64_t sum = 0;
+    bool writing = false;
+    for (size_type i = 0; i != window; ++i) {
+      const auto v = versions[(first_block + i) % num_blocks].load(order);
+      writing |= v % 2 != 0;
+      sum += v;
+    }
+    return writing ? ~std::uint64_t{0} : sum;
+  };
+
+  const std::uint64_t before = sum_versions(std::memory_order_acquire);
+  if (before == ~std::uint64_t{0})
+    return false; // A writer is working there.
+
+  size_type snapshot_q = 0;
+  while (size_type{1} << snapshot_q != window * bits_per_block)
+    ++snapshot_q;
+  qfilter snapshot(snapshot_q, remainder_bits(), layout(), false);
+  alignas(64) value_type buffer[max_snapshot_words];
+  assert(snapshot.storage_words() <= max_snapshot_words);
+  snapshot.words =
+      detail::word_buffer<value_type>(buffer, snapshot.storage_words());
+
+  copy_blocks(snapshot, first_block);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (sum_versions(std::memory_order_relaxed) != before)
+    return false;
+
+  const size_type limit = window == num_blocks
+                              ? capacity()
+                              : window * bits_per_block - pos % bits_per_block;
+  size_type span;
+  found = lookup(snapshot, pos % bits_per_block, filter.extract_remainder(fp),
+                 limit, span);
+  if (span >= limit) {
+    window = std::min(2 * window, num_blocks);
+    return false;
+  }
+  return true;
+}
+
+// Searches fp under the locks of its cluster, for runs too long to be copied.
+bool cfilter::locked_lookup(const value_type fp) const {
+  const size_type canonical = canonical_pos(fp);
+  const value_type remainder = filter.extract_remainder(fp);
+  region_lock lock(*this, canonical);
+
+  if (!filter.is_occupied(canonical))
+    return false;
+
+  const size_type run_start = filter.find_run_start(canonical);
+  const size_type length = filter.run_length(run_start);
+  const size_type offset =
+      filter.lower_bound_in_run(run_start, length, remainder);
+  const size_type pos = (run_start + offset) & (capacity() - 1);
+  return offset != length && filter.get_remainder(pos) == remainder;
+}
+
+// Every failed attempt either widens the window or was torn by a writer, so
+// the optimistic attempts are bounded by max_lookup_attempts.
+size_type cfilter::count(const value_type fp) const {
+  size_type window = std::min<size_type>(2, capacity() / bits_per_block);
+  bool found = false;
+  for (size_type i = 0;
+       i != max_lookup_attempts && window <= max_snapshot_blocks; ++i) {
+    if (try_lookup(fp, window, found))
+      return found ? 1 : 0;
+  }
+  return locked_lookup(fp) ? 1 : 0;
+}
+
+// Takes room for one more fingerprint, so the filter never exceeds
+// max_size(). It is called under the locks of the cluster, once fp is known to
+// be missing and right before writing it.
+void cfilter::reserve_slot() {
+  size_type n = num_items.load(std::memory_order_relaxed);
+  do {
+    if (n == max_size())
+      throw filter_is_full();
+  } while (!num_items.compare_exchange_weak(n, n + 1,
+                                            std::memory_order_relaxed));
+}
+
+bool cfilter::insert(const value_type fp) {
+  const size_type canonical = canonical_pos(fp);
+  const value_type remainder = filter.extract_remainder(fp);
+  region_lock lock(*this, canonical);
+
+  if (filter.is_empty_slot(canonical)) {
+    reserve_slot();
+    lock.begin_write();
+    filter.set_flag(qfilter::occupied_word, canonical, true);
+    filter.set_remainder(canonical, remainder);
+    return true;
+  }
+
+  if (!filter.is_occupied(canonical)) {
+    reserve_slot();
+    lock.begin_write();
+    filter.set_flag(qfilter::occupied_word, canonical, true);
+    const size_type run_start = filter.find_new_run_start(canonical);
+    filter.insert_slot(canonical, run_start, 0, remainder, true);
+    return true;
+  }
+
+  const size_type run_start = filter.find_run_start(canonical);
+  const size_type length = filter.run_length(run_start);
+  const size_type offset =
+      filter.lower_bound_in_run(run_start, length, remainder);
+  const size_type pos = (run_start + offset) & (capacity() - 1);
+  if (offset != length && filter.get_remainder(pos) == remainder)
+    return false;
+
+  reserve_slot();
+  lock.begin_write();
+  filter.insert_slot(canonical, run_start, offset, remainder, false);
+  return true;
+}
+
+size_type cfilter::erase(const value_type fp) {
+  const size_type canonical = canonical_pos(fp);
+  const value_type remainder = filter.extract_remainder(fp);
+  region_lock lock(*this, canonical);
+
+  if (!filter.is_occupied(canonical))
+    return 0;
+
+  const size_type run_start = filter.find_run_start(canonical);
+  const size_type length = filter.run_length(run_start);
+  const size_type offset =
+      filter.lower_bound_in_run(run_start, length, remainder);
+  const size_type pos = (run_start + offset) & (capacity() - 1);
+  if (offset == length || filter.get_remainder(pos) != remainder)
+    return 0;
+
+  lock.begin_write();
+  filter.remove_entry(pos, canonical);
+  num_items.fetch_sub(1, std::memory_order_relaxed);
+  return 1;
+}
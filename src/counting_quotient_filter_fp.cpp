@@ -0,0 +1,247 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <quofil/counting_quotient_filter_fp.hpp>
+#include <cassert> // for assert
+
+// ==========================================
+// General declarations.
+// ==========================================
+
+using cfilter = ::quofil::counting_quotient_filter_fp;
+using qfilter = ::quofil::quotient_filter_fp;
+using size_type = cfilter::size_type;
+using value_type = cfilter::value_type;
+
+// ==========================================
+// Counter encoding
+// ==========================================
+
+// The runs hold one entry per distinct remainder, sorted by remainder. An
+// entry of the remainder x inserted c times is encoded as:
+//
+//   c == 1: x
+//   c == 2: x x
+//   c >= 3: x d_1 ... d_k x, where d_1 ... d_k are the digits of c - 3 in base
+//           x, most significant first. Every digit is less than x, so it can
+//           not be confused with the end of the counter nor with the
+//           remainder of the next entry, which is greater than x.
+//
+// Two remainders are special. When x == 1 the only digit is zero, so the
+// counter is unary: c - 2 zeros. When x == 0 there are no digits at all, so
+// the entry is made of c zeros.
+
+struct cfilter::entry {
+  size_type offset; // Position within the run.
+  size_type length; // Number of slots.
+  value_type remainder;
+  size_type count;
+};
+
+// Returns the number of slots required to store the remainder x with the given
+// count.
+size_type cfilter::entry_length(const value_type x, const size_type count) const
+    noexcept {
+  assert(count != 0);
+  if (count <= 2 || x == 0)
+    return count;
+  if (x == 1)
+    return count; // x, c - 2 zeros, x
+
+  size_type num_digits = 1;
+  for (size_type n = (count - 3) / x; n != 0; n /= x)
+    ++num_digits;
+  return num_digits + 2;
+}
+
+// Decodes the entry which starts at the given offset of a run.
+auto cfilter::decode_entry(const size_type run_start, const size_type offset,
+                           const size_type run_length) const noexcept
+    -> entry {
+  assert(offset < run_length);
+  const auto mask = static_cast<size_type>(filter.quotient_mask);
+  const auto remainder_at = [&](size_type i) {
+    return filter.get_remainder((run_start + i) & mask);
+  };
+
+  const value_type x = remainder_at(offset);
+  size_type end = offset + 1;
+
+  if (x == 0) {
+    while (end != run_length && remainder_at(end) == 0)
+      ++end;
+    return {offset, end - offset, x, end - offset};
+  }
+
+  if (end == run_length || remainder_at(end) > x)
+    return {offset, 1, x, 1};
+  if (remainder_at(end) == x)
+    return {offset, 2, x, 2};
+
+  size_type n = 0;
+  for (value_type digit; (digit = remainder_at(end)) != x; ++end)
+    n = x == 1 ? n + 1 : n * x + digit;
+  if (x == 1)
+    --n; // There are n + 1 zeros.
+
+  ++end; // Skip the final x.
+  return {offset, end - offset, x, n + 3};
+}
+
+// Writes an entry into its slots, which must be part of the run.
+void cfilter::write_entry(const size_type run_start, const entry &e) noexcept {
+  assert(e.length == entry_length(e.remainder, e.count));
+  const auto mask = static_cast<size_type>(filter.quotient_mask);
+  const size_type pos = run_start + e.offset;
+  const auto set_slot = [&](size_type i, value_type value) {
+    filter.set_remainder((pos + i) & mask, value);
+  };
+
+  const value_type x = e.remainder;
+  set_slot(0, x);
+  if (x == 0) {
+    for (size_type i = 1; i != e.length; ++i)
+      set_slot(i, 0);
+    return;
+  }
+  if (e.count == 1)
+    return;
+
+  set_slot(e.length - 1, x);
+  if (x == 1) {
+    for (size_type i = 1; i != e.length - 1; ++i)
+      set_slot(i, 0);
+    return;
+  }
+
+  size_type n = e.count - 3;
+  for (size_type i = e.length - 2; i != 0; --i) {
+    set_slot(i, n % x);
+    n /= x;
+  }
+}
+
+// Returns the first entry of the run whose remainder is not less than x. If
+// there is no such entry, the returned entry has zero length and its offset is
+// the length of the run.
+auto cfilter::find_entry(const size_type run_start, const size_type run_length,
+                         const value_type x) const noexcept -> entry {
+  size_type offset = 0;
+  while (offset != run_length) {
+    const entry e = decode_entry(run_start, offset, run_length);
+    if (e.remainder >= x)
+      return e;
+    offset += e.length;
+  }
+  return {run_length, 0, 0, 0};
+}
+
+// ==========================================
+// Lookup
+// ==========================================
+
+size_type cfilter::count(const value_type fp) const noexcept {
+  if (filter.empty())
+    return 0;
+
+  const auto canonical_pos =
+      static_cast<size_type>(filter.extract_quotient(fp));
+  if (!filter.is_occupied(canonical_pos))
+    return 0;
+
+  const value_type x = filter.extract_remainder(fp);
+  const size_type run_start = filter.find_run_start(canonical_pos);
+  const entry e = find_entry(run_start, filter.run_length(run_start), x);
+  return e.length != 0 && e.remainder == x ? e.count : 0;
+}
+
+// ==========================================
+// Modifiers
+// ==========================================
+
+size_type cfilter::insert(const value_type fp, const size_type n) {
+  assert(n != 0 && "At least one insertion is required");
+  if (filter.capacity() == 0)
+    throw filter_is_full();
+
+  const size_type free_slots = filter.capacity() - filter.size();
+  const auto canonical_pos =
+      static_cast<size_type>(filter.extract_quotient(fp));
+  const value_type x = filter.extract_remainder(fp);
+
+  if (!filter.is_occupied(canonical_pos)) {
+    const entry e{0, entry_length(x, n), x, n};
+    if (e.length > free_slots)
+      throw filter_is_full();
+
+    // The first slot of the run is created as quotient_filter_fp::insert does.
+    size_type run_start = canonical_pos;
+    if (filter.is_empty_slot(canonical_pos)) {
+      filter.set_flag(qfilter::occupied_word, canonical_pos, true);
+    } else {
+      filter.set_flag(qfilter::occupied_word, canonical_pos, true);
+      run_start = filter.find_new_run_start(canonical_pos);
+      filter.insert_slot(canonical_pos, run_start, 0, x, true);
+    }
+    ++filter.num_elements;
+    for (size_type i = 1; i != e.length; ++i) {
+      filter.insert_slot(canonical_pos, run_start, i, x, false);
+      ++filter.num_elements;
+    }
+    write_entry(run_start, e);
+    num_items += n;
+    return n;
+  }
+
+  const size_type run_start = filter.find_run_start(canonical_pos);
+  entry e = find_entry(run_start, filter.run_length(run_start), x);
+
+  // The new slots go after the current ones, if any.
+  const size_type old_length = e.remainder == x ? e.length : 0;
+  e.remainder = x;
+  e.count = (old_length != 0 ? e.count : 0) + n;
+  e.length = entry_length(x, e.count);
+  if (e.length - old_length > free_slots)
+    throw filter_is_full();
+
+  for (size_type i = old_length; i != e.length; ++i) {
+    filter.insert_slot(canonical_pos, run_start, e.offset + i, x, false);
+    ++filter.num_elements;
+  }
+  write_entry(run_start, e);
+  num_items += n;
+  return e.count;
+}
+
+size_type cfilter::erase(const value_type fp) noexcept {
+  if (filter.empty())
+    return 0;
+
+  const auto canonical_pos =
+      static_cast<size_type>(filter.extract_quotient(fp));
+  if (!filter.is_occupied(canonical_pos))
+    return 0;
+
+  const value_type x = filter.extract_remainder(fp);
+  const size_type run_start = filter.find_run_start(canonical_pos);
+  entry e = find_entry(run_start, filter.run_length(run_start), x);
+  if (e.length == 0 || e.remainder != x)
+    return 0;
+
+  // A smaller count never needs more slots. The spare slots are the last ones
+  // of the entry, except when the entry disappears.
+  const size_type old_length = e.length;
+  e.length = --e.count != 0 ? entry_length(x, e.count) : 0;
+  const auto mask = static_cast<size_type>(filter.quotient_mask);
+  for (size_type i = e.length; i != old_length; ++i) {
+    filter.remove_entry((run_start + e.offset + e.length) & mask,
+                        canonical_pos);
+    --filter.num_elements;
+  }
+  if (e.count != 0)
+    write_entry(run_start, e);
+  --num_items;
+  return 1;
+}
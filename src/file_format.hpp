@@ -0,0 +1,98 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Format of the files and buffers which store a quotient_filter_fp:
+//
+//   [header: 64 bytes][words of the slots, as laid out in memory]
+//
+// The words follow the slot layout recorded in the header, so a filter can
+// use them in place. Every field is written in the byte order of the machine,
+// which is checked when the file is read. A filter with zero capacity has
+// zero quotient and remainder bits and no words.
+
+#ifndef QUOFIL_SRC_FILE_FORMAT_HPP
+#define QUOFIL_SRC_FILE_FORMAT_HPP
+
+#include <quofil/quotient_filter_fp.hpp> // for quofil::bad_filter_format
+
+#include <limits>  // for std::numeric_limits
+#include <cstddef> // for std::size_t
+#include <cstdint> // for std::uint{32,64}_t
+#include <cstring> // for std::memcmp, std::memcpy
+
+namespace quofil {
+namespace detail {
+
+constexpr std::uint32_t file_version = 1;
+constexpr std::uint32_t file_byte_order = 0x01020304;
+constexpr std::size_t file_header_size = 64;
+
+struct file_header {
+  char magic[8];               // "QUOFILFP"
+  std::uint32_t version;       // file_version
+  std::uint32_t byte_order;    // file_byte_order
+  std::uint32_t word_bits;     // Bits of quotient_filter_fp::value_type.
+  std::uint32_t layout;        // slot_layout as an integer.
+  std::uint64_t quotient_bits;
+  std::uint64_t remainder_bits;
+  std::uint64_t num_elements;
+  std::uint64_t num_words;     // Words following the header.
+  std::uint64_t hash_tag;      // Identifies the hash function.
+};
+
+static_assert(sizeof(file_header) == file_header_size,
+              "The header must take exactly file_header_size bytes");
+
+constexpr char file_magic[8] = {'Q', 'U', 'O', 'F', 'I', 'L', 'F', 'P'};
+
+inline file_header make_file_header(std::size_t q, std::size_t r,
+                                    slot_layout layout,
+                                    std::size_t num_elements,
+                                    std::size_t num_words,
+                                    std::uint64_t hash_tag = 0) noexcept {
+  file_header header{};
+  std::memcpy(header.magic, file_magic, sizeof(file_magic));
+  header.version = file_version;
+  header.byte_order = file_byte_order;
+  header.word_bits = std::numeric_limits<std::size_t>::digits;
+  header.layout = static_cast<std::uint32_t>(layout);
+  header.quotient_bits = q;
+  header.remainder_bits = r;
+  header.num_elements = num_elements;
+  header.num_words = num_words;
+  header.hash_tag = hash_tag;
+  return header;
+}
+
+// Throws bad_filter_format unless the header describes a filter which can be
+// used on this machine. The number of words must be checked by the caller.
+inline void check_file_header(const file_header &header) {
+  constexpr std::uint64_t word_bits = std::numeric_limits<std::size_t>::digits;
+  if (std::memcmp(header.magic, file_magic, sizeof(file_magic)) != 0)
+    throw bad_filter_format("Not a quotient filter");
+  if (header.version != file_version)
+    throw bad_filter_format("Unsupported quotient filter format version");
+  if (header.byte_order != file_byte_order || header.word_bits != word_bits)
+    throw bad_filter_format("The quotient filter was stored by an "
+                            "incompatible machine");
+  if (header.layout != static_cast<std::uint32_t>(slot_layout::separate) &&
+      header.layout != static_cast<std::uint32_t>(slot_layout::blocked))
+    throw bad_filter_format("Unknown slot layout");
+  if (header.quotient_bits == 0 && header.remainder_bits == 0) {
+    if (header.num_elements != 0 || header.num_words != 0)
+      throw bad_filter_format("Invalid filter with zero capacity");
+    return;
+  }
+  if (header.quotient_bits >= word_bits || header.remainder_bits == 0 ||
+      header.quotient_bits + header.remainder_bits > word_bits)
+    throw bad_filter_format("Invalid quotient or remainder bits");
+  if (header.num_elements > (std::uint64_t{1} << header.quotient_bits))
+    throw bad_filter_format("Invalid number of elements");
+}
+
+} // end namespace detail
+} // end namespace quofil
+
+#endif // Header guard
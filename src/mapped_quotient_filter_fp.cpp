@@ -0,0 +1,167 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <quofil/mapped_quotient_filter_fp.hpp>
+#include "file_format.hpp"
+#include <system_error> // for std::system_error, std::generic_category
+#include <cerrno>       // for errno
+#include <cstring>      // for std::memcpy
+
+#include <fcntl.h>    // for ::open
+#include <sys/mman.h> // for ::mmap, ::msync, ::munmap
+#include <sys/stat.h> // for ::fstat
+#include <unistd.h>   // for ::close, ::ftruncate
+
+// ==========================================
+// General declarations.
+// ==========================================
+
+using mfilter = ::quofil::mapped_quotient_filter_fp;
+using qfilter = ::quofil::quotient_filter_fp;
+using size_type = mfilter::size_type;
+using value_type = mfilter::value_type;
+using ::quofil::detail::file_header;
+using ::quofil::detail::file_header_size;
+
+[[noreturn]] static void throw_errno(const char *what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+namespace {
+// Closes a file descriptor on destruction. A mapping outlives it.
+class file_descriptor {
+public:
+  explicit file_descriptor(int fd_) noexcept : fd{fd_} {}
+  file_descriptor(const file_descriptor &) = delete;
+  file_descriptor &operator=(const file_descriptor &) = delete;
+  ~file_descriptor() { ::close(fd); }
+  int get() const noexcept { return fd; }
+
+private:
+  int fd;
+};
+} // end anonymous namespace
+
+// Maps 'length' bytes of the given file for reading and writing.
+static void *map_file(const file_descriptor &file, const std::size_t length) {
+  void *const address = ::mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                               MAP_SHARED, file.get(), 0);
+  if (address == MAP_FAILED)
+    throw_errno("Can not map the quotient filter file");
+  return address;
+}
+
+static file_header &header_of(void *address) noexcept {
+  return *static_cast<file_header *>(address);
+}
+
+// ==========================================
+// Member functions
+// ==========================================
+
+mfilter mfilter::create(const std::string &path, const size_type q,
+                        const size_type r, const slot_layout layout) {
+  qfilter filter(q, r, layout, false);
+  const size_type num_words = filter.storage_words();
+  const std::size_t length = file_header_size + num_words * sizeof(value_type);
+
+  const file_descriptor file(
+      ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666));
+  if (file.get() == -1)
+    throw_errno("Can not create the quotient filter file");
+  // The file grows filled with zeros, which is an empty filter.
+  if (::ftruncate(file.get(), static_cast<off_t>(length)) == -1)
+    throw_errno("Can not resize the quotient filter file");
+
+  void *const address = map_file(file, length);
+  const file_header header =
+      detail::make_file_header(q, r, layout, 0, num_words);
+  std::memcpy(address, &header, sizeof(header));
+  return mfilter(std::move(filter), address, length);
+}
+
+mfilter mfilter::open(const std::string &path) {
+  const file_descriptor file(::open(path.c_str(), O_RDWR));
+  if (file.get() == -1)
+    throw_errno("Can not open the quotient filter file");
+
+  struct ::stat status;
+  if (::fstat(file.get(), &status) == -1)
+    throw_errno("Can not get the size of the quotient filter file");
+  const auto file_size = static_cast<std::size_t>(status.st_size);
+  if (file_size < file_header_size)
+    throw bad_filter_format("Truncated quotient filter header");
+
+  void *const address = map_file(file, file_size);
+  try {
+    const file_header &header = header_of(address);
+    detail::check_file_header(header);
+    if (header.remainder_bits == 0)
+      throw bad_filter_format("A mapped quotient filter needs some slots");
+    qfilter filter(header.quotient_bits, header.remainder_bits,
+                   static_cast<slot_layout>(header.layout), false);
+    const size_type num_words = filter.storage_words();
+    if (header.num_words != num_words ||
+        file_size != file_header_size + num_words * sizeof(value_type))
+      throw bad_filter_format("Wrong size of the quotient filter data");
+    filter.num_elements = header.num_elements;
+    return mfilter(std::move(filter), address, file_size);
+  } catch (...) {
+    ::munmap(address, file_size);
+    throw;
+  }
+}
+
+// Takes the ownership of the mapping and makes the filter use its words.
+mfilter::mapped_quotient_filter_fp(qfilter &&filter, void *address_,
+                                   std::size_t length_) noexcept
+    : filter_(std::move(filter)), address{address_}, length{length_} {
+  auto *const words = reinterpret_cast<value_type *>(
+      static_cast<char *>(address) + file_header_size);
+  filter_.words = detail::word_buffer<value_type>(
+      words, (length - file_header_size) / sizeof(value_type));
+}
+
+mfilter::mapped_quotient_filter_fp(mapped_quotient_filter_fp &&other) noexcept
+    : filter_(std::move(other.filter_)),
+      address{other.address},
+      length{other.length} {
+  other.address = nullptr;
+  other.length = 0;
+}
+
+mfilter &mfilter::operator=(mapped_quotient_filter_fp &&other) noexcept {
+  if (this != &other) {
+    unmap();
+    filter_ = std::move(other.filter_);
+    address = other.address;
+    length = other.length;
+    other.address = nullptr;
+    other.length = 0;
+  }
+  return *this;
+}
+
+mfilter::~mapped_quotient_filter_fp() { unmap(); }
+
+void mfilter::sync() {
+  if (::msync(address, length, MS_SYNC) == -1)
+    throw_errno("Can not write the quotient filter file");
+}
+
+// Called after every modification, so the header never holds a stale count.
+void mfilter::store_size() noexcept {
+  header_of(address).num_elements = filter_.size();
+}
+
+// Releases the mapping, if any. The operating system writes the modified pages
+// back to the file.
+void mfilter::unmap() noexcept {
+  if (address == nullptr)
+    return;
+  ::munmap(address, length);
+  address = nullptr;
+  length = 0;
+}
@@ -4,10 +4,23 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 #include <quofil/quotient_filter_fp.hpp>
-#include <algorithm>   // for std::min, std::fill
+#include "file_format.hpp"
+#include "run_search.hpp"
+#include <quofil/detail/parallel.hpp>
+#include <quofil/detail/relaxed_word.hpp>
+#include <algorithm>   // for std::{min, max, sort, for_each, fill}
+#include <atomic>      // for std::atomic
+#include <deque>       // for std::deque
+#include <istream>     // for std::istream
+#include <ostream>     // for std::ostream
 #include <limits>      // for std::numeric_limits
 #include <type_traits> // for std::is_unsigned
+#include <utility>     // for std::move
 #include <cassert>     // for assert
+#include <climits>     // for CHAR_BIT
+#include <cstddef>     // for std::ptrdiff_t
+#include <cstdint>     // for std::uint{8,16,32,64}_t, std::uintptr_t
+#include <cstring>     // for std::memcpy
 
 // ==========================================
 // General declarations.
@@ -19,6 +32,7 @@ using size_type = qfilter::size_type;
 using value_type = qfilter::value_type;
 
 using std::make_pair;
+using quofil::detail::store_relaxed;
 
 static_assert(std::is_unsigned<value_type>::value,
               "value_type (the type of hash values) must be unsigned.");
@@ -30,6 +44,10 @@ static_assert(sizeof(value_type) >= sizeof(unsigned),
 static constexpr size_type bits_per_block =
     std::numeric_limits<value_type>::digits;
 
+static constexpr size_type words_per_line =
+    quofil::detail::cache_aligned_allocator<value_type>::alignment /
+    sizeof(value_type);
+
 // ==========================================
 // Exceptions.
 // ==========================================
@@ -51,38 +69,274 @@ static constexpr value_type low_mask(size_type num_bits) noexcept {
   return ~(~value_type{0} << num_bits);
 }
 
+// ==========================================
+// Bit manipulation functions
+// ==========================================
+
+// Returns the number of set bits of word.
+static size_type popcount(value_type word) noexcept {
+#if defined(__GNUC__)
+  return static_cast<size_type>(__builtin_popcountll(word));
+#else
+  size_type count = 0;
+  for (; word; word &= word - 1)
+    ++count;
+  return count;
+#endif
+}
+
+// Returns the index of the least significant set bit of word.
+// Requires: word != 0
+static size_type count_trailing_zeros(value_type word) noexcept {
+  assert(word != 0);
+#if defined(__GNUC__)
+  return static_cast<size_type>(__builtin_ctzll(word));
+#else
+  size_type count = 0;
+  for (; !(word & 1); word >>= 1)
+    ++count;
+  return count;
+#endif
+}
+
+// Returns the index of the most significant set bit of word.
+// Requires: word != 0
+static size_type highest_bit(value_type word) noexcept {
+  assert(word != 0);
+#if defined(__GNUC__)
+  return bits_per_block - 1 - static_cast<size_type>(__builtin_clzll(word));
+#else
+  size_type index = 0;
+  while (word >>= 1)
+    ++index;
+  return index;
+#endif
+}
+
+// Returns the index of the n-th (zero based) set bit of word.
+// Requires: n < popcount(word)
+static size_type select_bit(value_type word, size_type n) noexcept {
+  assert(n < popcount(word));
+  while (n--)
+    word &= word - 1;
+  return count_trailing_zeros(word);
+}
+
+// Returns a word whose bits in [first, last) are set.
+// Requires: first <= last <= bits_per_block
+static value_type bit_range(size_type first, size_type last) noexcept {
+  assert(first <= last && last <= bits_per_block);
+  if (first == last)
+    return 0;
+  return (~value_type{0} >> (bits_per_block - (last - first))) << first;
+}
+
+// Returns the count bits of data which start at the given bit.
+// Requires: 0 < count <= bits_per_block
+static value_type read_bits(const value_type *data, size_type bit,
+                            size_type count) noexcept {
+  const size_type word = bit / bits_per_block;
+  const size_type offset = bit % bits_per_block;
+  value_type value = data[word] >> offset;
+  if (offset + count > bits_per_block)
+    value |= data[word + 1] << (bits_per_block - offset);
+  return value & bit_range(0, count);
+}
+
+// Replaces the count bits of data which start at the given bit.
+// Requires: 0 < count <= bits_per_block
+static void write_bits(value_type *data, size_type bit, size_type count,
+                       value_type value) noexcept {
+  const size_type word = bit / bits_per_block;
+  const size_type offset = bit % bits_per_block;
+  const size_type low_count = std::min(count, bits_per_block - offset);
+  const value_type low_bits = bit_range(offset, offset + low_count);
+  store_relaxed(data[word],
+                (data[word] & ~low_bits) | ((value << offset) & low_bits));
+  if (low_count != count) {
+    const value_type high_bits = bit_range(0, count - low_count);
+    store_relaxed(data[word + 1], (data[word + 1] & ~high_bits) |
+                                      ((value >> low_count) & high_bits));
+  }
+}
+
+// Moves the bits [first, last) of data to [first + shift, last + shift), a
+// word at a time. The bits [first, first + shift) keep their old values.
+static void move_bits_up(value_type *data, const size_type first,
+                         size_type last, const size_type shift) noexcept {
+  // Going downwards, the source bits are read before being overwritten.
+  while (last != first) {
+    const size_type count = std::min(last - first, bits_per_block);
+    last -= count;
+    write_bits(data, last + shift, count, read_bits(data, last, count));
+  }
+}
+
+// Moves the bits [first, last) of data to [first - shift, last - shift), a
+// word at a time. The bits [last - shift, last) keep their old values.
+static void move_bits_down(value_type *data, size_type first,
+                           const size_type last,
+                           const size_type shift) noexcept {
+  // Going upwards, the source bits are read before being overwritten.
+  while (first != last) {
+    const size_type count = std::min(last - first, bits_per_block);
+    write_bits(data, first - shift, count, read_bits(data, first, count));
+    first += count;
+  }
+}
+
+// ==========================================
+// Bit scanning functions
+// ==========================================
+
+// The following functions scan a bit sequence of num_slots bits, provided one
+// word at a time by get_word(block), skipping whole words when possible.
+
+// Returns the first position in [pos, num_slots) whose bit is set, or
+// num_slots if there is no such position.
+template <typename GetWord>
+static size_type find_next_bit(const size_type pos, const size_type num_slots,
+                               GetWord get_word) noexcept {
+  if (pos >= num_slots)
+    return num_slots;
+
+  const size_type num_blocks = ceil_div(num_slots, bits_per_block);
+  size_type block = pos / bits_per_block;
+  value_type word = get_word(block) & ~low_mask(pos % bits_per_block);
+  while (!word) {
+    if (++block == num_blocks)
+      return num_slots;
+    word = get_word(block);
+  }
+  // The bits after num_slots could be set in the last block.
+  return std::min(block * bits_per_block + count_trailing_zeros(word),
+                  num_slots);
+}
+
+// Returns the last position in [0, pos] whose bit is set, or num_slots if
+// there is no such position.
+template <typename GetWord>
+static size_type find_prev_bit(const size_type pos, const size_type num_slots,
+                               GetWord get_word) noexcept {
+  const size_type offset = pos % bits_per_block;
+  const value_type up_to_pos = ~value_type{0} >> (bits_per_block - 1 - offset);
+  size_type block = pos / bits_per_block;
+  value_type word = get_word(block) & up_to_pos;
+  while (!word) {
+    if (block == 0)
+      return num_slots;
+    word = get_word(--block);
+  }
+  return block * bits_per_block + highest_bit(word);
+}
+
+// ==========================================
+// Storage access functions
+// ==========================================
+
+value_type &qfilter::meta(const meta_word kind,
+                          const size_type block) noexcept {
+  return words[block * block_stride + kind * meta_stride];
+}
+
+const value_type &qfilter::meta(const meta_word kind,
+                                const size_type block) const noexcept {
+  return words[block * block_stride + kind * meta_stride];
+}
+
+value_type *qfilter::remainders(const size_type block) noexcept {
+  return &words[remainders_base + block * remainders_stride];
+}
+
+const value_type *qfilter::remainders(const size_type block) const noexcept {
+  return &words[remainders_base + block * remainders_stride];
+}
+
 // ==========================================
 // Flag functions
 // ==========================================
 
-using bit_reference = std::vector<bool>::reference;
+bool qfilter::get_flag(const meta_word kind, const size_type pos) const
+    noexcept {
+  const value_type word = meta(kind, pos / bits_per_block);
+  return (word >> (pos % bits_per_block)) & 1;
+}
 
-static bool exchange(bit_reference bit, bool new_value) noexcept {
-  const bool old_value = bit;
-  bit = new_value;
+void qfilter::set_flag(const meta_word kind, const size_type pos,
+                       const bool value) noexcept {
+  value_type &word = meta(kind, pos / bits_per_block);
+  const value_type bit = value_type{1} << (pos % bits_per_block);
+  store_relaxed(word, value ? word | bit : word & ~bit);
+}
+
+bool qfilter::exchange_flag(const meta_word kind, const size_type pos,
+                            const bool new_value) noexcept {
+  const bool old_value = get_flag(kind, pos);
+  set_flag(kind, pos, new_value);
   return old_value;
 }
 
 bool qfilter::is_empty_slot(size_type pos) const noexcept {
-  return !is_occupied[pos] && !is_continuation[pos] && !is_shifted[pos];
+  return !is_occupied(pos) && !is_continuation(pos) && !is_shifted(pos);
+}
+
+// Returns a word with the bits of the empty slots of the given block.
+value_type qfilter::empty_slots(const size_type block) const noexcept {
+  return ~(meta(occupied_word, block) | meta(continuation_word, block) |
+           meta(shifted_word, block));
 }
 
 // ==========================================
 // Data access functions
 // ==========================================
 
+// On little endian machines, remainders of 8, 16 or 32 bits are packed exactly
+// as an array of integers of that width, so they can be read with a single
+// load.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+static constexpr bool native_remainders = true;
+#else
+static constexpr bool native_remainders = false;
+#endif
+
+template <typename T>
+static value_type load_native(const value_type *data,
+                              size_type index) noexcept {
+  T value;
+  std::memcpy(&value, reinterpret_cast<const unsigned char *>(data) +
+                          index * sizeof(T),
+              sizeof(T));
+  return value;
+}
+
+// A block holds bits_per_block remainders of r_bits each, that is, exactly
+// r_bits words. Thereby, a remainder never spans two blocks.
 value_type qfilter::get_remainder(const size_type pos) const noexcept {
-  const size_type num_bit = r_bits * pos;
-  const size_type block = num_bit / bits_per_block;
+  const value_type *const data = remainders(pos / bits_per_block);
+  const size_type slot = pos % bits_per_block;
+
+  if (native_remainders) {
+    switch (r_bits) {
+    case 8:
+      return load_native<std::uint8_t>(data, slot);
+    case 16:
+      return load_native<std::uint16_t>(data, slot);
+    case 32:
+      return load_native<std::uint32_t>(data, slot);
+    }
+  }
+
+  const size_type num_bit = r_bits * slot;
+  const size_type word = num_bit / bits_per_block;
   const size_type offset = num_bit % bits_per_block;
 
   size_type pending_bits = r_bits;
   size_type bits_to_read = std::min(pending_bits, bits_per_block - offset);
 
-  value_type ans = (data[block] >> offset) & low_mask(bits_to_read);
+  value_type ans = (data[word] >> offset) & low_mask(bits_to_read);
   pending_bits -= bits_to_read;
   if (pending_bits) {
-    value_type next = data[block + 1] & low_mask(pending_bits);
+    value_type next = data[word + 1] & low_mask(pending_bits);
     ans |= next << bits_to_read;
   }
   return ans;
@@ -94,28 +348,121 @@ void qfilter::set_remainder(const size_type pos,
 
   assert(value == (value & remainder_mask));
 
-  const size_type num_bit = r_bits * pos;
-  const size_type block = num_bit / bits_per_block;
-  const size_type offset = num_bit % bits_per_block;
+  // Whole words are stored, even for native remainders, since concurrent
+  // readers load whole words.
+  value_type *const data = remainders(pos / bits_per_block);
+  write_bits(data, r_bits * (pos % bits_per_block), r_bits, value);
+}
 
-  size_type pending_bits = r_bits;
-  size_type bits_to_write = std::min(pending_bits, bits_per_block - offset);
+// ==========================================
+// Bulk slot movement
+// ==========================================
 
-  data[block] &= ~(low_mask(bits_to_write) << offset);
-  data[block] |= value << offset;
+// The following functions move whole ranges of slots with word operations.
+// Only the remainders and the continuation flags are moved, since the
+// occupied flags belong to the canonical slots and the shifted flags are
+// handled by the callers.
+
+// Moves the slots [first, last) to [first + 1, last + 1). The slot 'first'
+// keeps its old contents.
+// Requires: first <= last < num_slots
+void qfilter::move_slots_up(const size_type first,
+                            const size_type last) noexcept {
+  assert(first <= last && last < num_slots);
+  if (first == last)
+    return;
 
-  pending_bits -= bits_to_write;
-  if (pending_bits) {
-    data[block + 1] &= ~low_mask(pending_bits);
-    data[block + 1] |= value >> bits_to_write;
+  const size_type first_block = first / bits_per_block;
+  for (size_type block = last / bits_per_block;; --block) {
+    // The last slot of each block but the last one goes to the next block.
+    const size_type begin = block * bits_per_block;
+    const size_type lo = std::max(first, begin) - begin;
+    const size_type hi = std::min(last - begin, bits_per_block - 1);
+
+    value_type &continuations = meta(continuation_word, block);
+    const value_type dest = bit_range(lo + 1, hi + 1);
+    store_relaxed(continuations,
+                  (continuations & ~dest) | ((continuations << 1) & dest));
+    move_bits_up(remainders(block), lo * r_bits, hi * r_bits, r_bits);
+
+    if (block == first_block)
+      return;
+    set_flag(continuation_word, begin, is_continuation(begin - 1));
+    set_remainder(begin, get_remainder(begin - 1));
   }
 }
 
-value_type qfilter::exchange_remainder(size_type pos,
-                                       value_type new_value) noexcept {
-  value_type old_value = get_remainder(pos);
-  set_remainder(pos, new_value);
-  return old_value;
+// Moves the slots [first + 1, last + 1) to [first, last). The slot 'last'
+// keeps its old contents.
+// Requires: first <= last < num_slots
+void qfilter::move_slots_down(const size_type first,
+                              const size_type last) noexcept {
+  assert(first <= last && last < num_slots);
+  if (first == last)
+    return;
+
+  const size_type last_block = last / bits_per_block;
+  for (size_type block = first / bits_per_block;; ++block) {
+    // The last slot of each block but the last one comes from the next block.
+    const size_type begin = block * bits_per_block;
+    const size_type lo = std::max(first, begin) - begin;
+    const size_type hi = std::min(last - begin, bits_per_block - 1);
+
+    value_type &continuations = meta(continuation_word, block);
+    const value_type dest = bit_range(lo, hi);
+    store_relaxed(continuations,
+                  (continuations & ~dest) | ((continuations >> 1) & dest));
+    move_bits_down(remainders(block), (lo + 1) * r_bits, (hi + 1) * r_bits,
+                   r_bits);
+
+    if (block == last_block)
+      return;
+    const size_type end = begin + bits_per_block;
+    set_flag(continuation_word, end - 1, is_continuation(end));
+    set_remainder(end - 1, get_remainder(end));
+  }
+}
+
+// Moves the slots [first, last) one position to the right, cyclically.
+void qfilter::shift_slots_right(const size_type first,
+                                const size_type last) noexcept {
+  if (first <= last) {
+    move_slots_up(first, last);
+    return;
+  }
+  move_slots_up(0, last);
+  set_flag(continuation_word, 0, is_continuation(num_slots - 1));
+  set_remainder(0, get_remainder(num_slots - 1));
+  move_slots_up(first, num_slots - 1);
+}
+
+// Moves the slots (first, last] one position to the left, cyclically.
+void qfilter::shift_slots_left(const size_type first,
+                               const size_type last) noexcept {
+  if (first <= last) {
+    move_slots_down(first, last);
+    return;
+  }
+  move_slots_down(first, num_slots - 1);
+  set_flag(continuation_word, num_slots - 1, is_continuation(0));
+  set_remainder(num_slots - 1, get_remainder(0));
+  move_slots_down(0, last);
+}
+
+// Sets the flags of the given kind of the slots [first, last].
+// Requires: first <= last < num_slots
+void qfilter::set_flags(const meta_word kind, const size_type first,
+                        const size_type last) noexcept {
+  assert(first <= last && last < num_slots);
+  const size_type last_block = last / bits_per_block;
+  for (size_type block = first / bits_per_block; block <= last_block;
+       ++block) {
+    const size_type begin = block * bits_per_block;
+    const size_type lo = std::max(first, begin) - begin;
+    const size_type hi = std::min(last - begin, bits_per_block - 1);
+    value_type &word = meta(kind, block);
+    store_relaxed(word, word | bit_range(lo, hi + 1));
+  }
 }
 
 // ==========================================
@@ -148,68 +495,461 @@ value_type qfilter::extract_remainder(value_type fp) const noexcept {
 // Constructor
 // ==========================================
 
-qfilter::quotient_filter_fp(size_type q, size_type r)
+qfilter::quotient_filter_fp(size_type q, size_type r, slot_layout layout)
+    : quotient_filter_fp(q, r, layout, true) {}
+
+// Sets up the layout of the slots. The words are only allocated if 'allocate'
+// is true, otherwise they must be provided later, e.g. by a mapped file.
+qfilter::quotient_filter_fp(size_type q, size_type r, slot_layout layout,
+                            bool allocate)
     : q_bits{q}, r_bits{r}, num_slots{size_type{1} << q}, num_elements{0},
-      quotient_mask{low_mask(q)}, remainder_mask{low_mask(r)},
-      is_occupied(num_slots), is_continuation(num_slots), is_shifted(num_slots),
-      data{} {
+      quotient_mask{low_mask(q)}, remainder_mask{low_mask(r)}, layout_{layout},
+      words{} {
   assert(r != 0 && "The remainder must have at least one bit");
-  const size_type required_bits = r_bits * num_slots;
-  const size_type required_blocks = ceil_div(required_bits, bits_per_block);
-  data.resize(required_blocks);
+  const size_type num_blocks = ceil_div(num_slots, bits_per_block);
+
+  switch (layout) {
+  case slot_layout::separate:
+    // [occupied words][continuation words][shifted words][offset words]
+    // [remainders]
+    block_stride = 1;
+    meta_stride = num_blocks;
+    remainders_base = meta_words_per_block * num_blocks;
+    remainders_stride = r_bits;
+    break;
+  case slot_layout::blocked:
+    // [metadata words, remainders, padding] for each block. The padding
+    // keeps every block aligned to a cache line.
+    block_stride = ceil_div(meta_words_per_block + r_bits, words_per_line) *
+                   words_per_line;
+    meta_stride = 1;
+    remainders_base = meta_words_per_block;
+    remainders_stride = block_stride;
+    break;
+  }
+
+  if (allocate)
+    words = detail::word_buffer<value_type>(storage_words());
+}
+
+// Returns the number of words required by the slots.
+size_type qfilter::storage_words() const noexcept {
+  const size_type num_blocks = ceil_div(num_slots, bits_per_block);
+  return remainders_base + num_blocks * remainders_stride;
+}
+
+// ==========================================
+// Memory usage
+// ==========================================
+
+quofil::memory_footprint qfilter::memory_usage() const noexcept {
+  constexpr size_type word_bytes = sizeof(value_type);
+  // The allocator reserves room to align the words and to remember the
+  // address returned by operator new.
+  constexpr size_type alignment_bytes =
+      quofil::detail::cache_aligned_allocator<value_type>::alignment +
+      sizeof(void *);
+
+  const size_type num_blocks = ceil_div(num_slots, bits_per_block);
+  memory_footprint usage;
+  usage.metadata = num_blocks * meta_words_per_block * word_bytes;
+  usage.remainders = num_blocks * r_bits * word_bytes;
+  usage.slack = words.size() * word_bytes - usage.metadata - usage.remainders;
+  if (words.size() != 0 && !words.is_external())
+    usage.slack += alignment_bytes;
+  return usage;
+}
+
+double qfilter::bits_per_element() const noexcept {
+  if (empty())
+    return 0;
+  return static_cast<double>(memory_usage().total() * CHAR_BIT) /
+         static_cast<double>(size());
+}
+
+// ==========================================
+// Statistics
+// ==========================================
+
+void quofil::slot_histogram::add(const std::size_t value) {
+  if (value >= counts.size())
+    counts.resize(value + 1);
+  ++counts[value];
+}
+
+std::size_t quofil::slot_histogram::total() const noexcept {
+  std::size_t sum = 0;
+  for (const std::size_t count : counts)
+    sum += count;
+  return sum;
+}
+
+double quofil::slot_histogram::mean() const noexcept {
+  double sum = 0;
+  for (std::size_t value = 0; value != counts.size(); ++value)
+    sum += static_cast<double>(value) * static_cast<double>(counts[value]);
+  const std::size_t n = total();
+  return n == 0 ? 0 : sum / static_cast<double>(n);
+}
+
+std::size_t quofil::slot_histogram::percentile(const double fraction) const
+    noexcept {
+  assert(fraction >= 0 && fraction <= 1);
+  const auto target = static_cast<double>(total()) * fraction;
+  std::size_t seen = 0;
+  for (std::size_t value = 0; value != counts.size(); ++value) {
+    seen += counts[value];
+    if (seen != 0 && static_cast<double>(seen) >= target)
+      return value;
+  }
+  return 0;
+}
+
+// The pass starts at an empty slot, so no cluster or span is split, unless the
+// filter is full. In that case it starts at a cluster start and the only span
+// covers all the slots. The canonical slot of each run is the next occupied
+// one after the canonical slot of the previous run of the cluster.
+quofil::filter_statistics qfilter::statistics() const {
+  filter_statistics stats;
+  if (empty())
+    return stats;
+
+  const auto mask = static_cast<size_type>(quotient_mask);
+  const size_type first = full() ? find_cluster_start(0) : find_next_empty(0);
+  size_type cluster_length = 0;
+  size_type run_length = 0;
+  size_type span_length = 0;
+  size_type quotient = 0;
+
+  const auto end_run = [&] {
+    if (run_length != 0)
+      stats.run_lengths.add(run_length);
+    run_length = 0;
+  };
+  const auto end_cluster = [&] {
+    end_run();
+    if (cluster_length != 0)
+      stats.cluster_lengths.add(cluster_length);
+    cluster_length = 0;
+  };
+  const auto end_span = [&] {
+    end_cluster();
+    if (span_length != 0)
+      stats.span_lengths.add(span_length);
+    span_length = 0;
+  };
+
+  size_type pos = first;
+  for (size_type i = 0; i != num_slots; ++i, pos = incr_pos(pos)) {
+    if (is_empty_slot(pos)) {
+      end_span();
+      continue;
+    }
+    if (!is_shifted(pos)) {
+      end_cluster();
+      quotient = pos;
+    } else if (!is_continuation(pos)) {
+      end_run();
+      quotient = find_next_occupied(quotient);
+    }
+    ++cluster_length;
+    ++run_length;
+    ++span_length;
+    stats.shift_distances.add((pos - quotient) & mask);
+  }
+  end_span();
+  return stats;
+}
+
+// ==========================================
+// Run offsets
+// ==========================================
+
+// Returns a word with the bits of the slots of the given block which start a
+// run, that is, the non-empty slots which are not continuations.
+value_type qfilter::run_starts(const size_type block) const noexcept {
+  const value_type occupied = meta(occupied_word, block);
+  const value_type shifted = meta(shifted_word, block);
+  return (occupied | shifted) & ~meta(continuation_word, block);
+}
+
+// Recomputes the offsets of the blocks beginning in (first, last], where both
+// positions are taken cyclically. It must be called after modifying the runs
+// of that range. Note that the offset of a block depends only on the offset
+// and the contents of the previous one.
+void qfilter::update_offsets(const size_type first,
+                             const size_type last) noexcept {
+  // A cluster could have wrapped around up to the block where it begins
+  // (before or after the modification), so the offset of the first block
+  // could be outdated.
+  if (num_elements + bits_per_block >= num_slots) {
+    rebuild_offsets();
+    return;
+  }
+
+  const size_type num_blocks = ceil_div(num_slots, bits_per_block);
+  const size_type distance =
+      (last - first) & static_cast<size_type>(quotient_mask);
+  size_type pending = (first % bits_per_block + distance) / bits_per_block;
+  size_type block = first / bits_per_block;
+
+  while (pending--) {
+    const size_type next = (block + 1) % num_blocks;
+    store_relaxed(meta(offset_word, next),
+                  meta(offset_word, block) +
+                      popcount(meta(occupied_word, block)) -
+                      popcount(run_starts(block)));
+    block = next;
+  }
+}
+
+// Recomputes the offsets of all blocks. No run is pending at a slot which is
+// not shifted, so the computation starts from one of them.
+void qfilter::rebuild_offsets() noexcept {
+  const size_type num_blocks = ceil_div(num_slots, bits_per_block);
+  const value_type valid_slots =
+      num_slots < bits_per_block ? low_mask(num_slots) : ~value_type{0};
+
+  size_type block = 0;
+  while (block != num_blocks && !(~meta(shifted_word, block) & valid_slots))
+    ++block;
+  assert(block != num_blocks && "There must be a non-shifted slot");
+
+  const value_type not_shifted = ~meta(shifted_word, block) & valid_slots;
+  const value_type since_anchor = ~low_mask(count_trailing_zeros(not_shifted));
+  value_type offset = popcount(meta(occupied_word, block) & since_anchor) -
+                      popcount(run_starts(block) & since_anchor);
+
+  for (size_type i = 0; i != num_blocks; ++i) {
+    block = (block + 1) % num_blocks;
+    store_relaxed(meta(offset_word, block), offset);
+    offset += popcount(meta(occupied_word, block));
+    offset -= popcount(run_starts(block));
+  }
 }
 
 // ==========================================
 // Search
 // ==========================================
 
-size_type qfilter::find_next_occupied(size_type pos) const noexcept {
-  do
-    pos = incr_pos(pos);
-  while (!is_occupied[pos]);
-  return pos;
+// Returns the next occupied position after pos (cyclically). There must be at
+// least one occupied position.
+size_type qfilter::find_next_occupied(const size_type pos) const noexcept {
+  const auto occupied = [this](size_type block) {
+    return meta(occupied_word, block);
+  };
+  const size_type found = find_next_bit(incr_pos(pos), num_slots, occupied);
+  return found != num_slots ? found : find_next_bit(0, num_slots, occupied);
 }
 
-size_type qfilter::find_next_run_quotient(size_type pos) const noexcept {
+// Returns the next occupied position after pos without wrapping around, or
+// num_slots if there is no such position.
+size_type qfilter::find_next_run_quotient(const size_type pos) const noexcept {
   assert(pos < num_slots);
-  assert(is_occupied[pos]);
-  do
-    ++pos;
-  while (pos != num_slots && !is_occupied[pos]);
-  return pos;
+  assert(is_occupied(pos));
+  return find_next_bit(pos + 1, num_slots, [this](size_type block) {
+    return meta(occupied_word, block);
+  });
+}
+
+// Returns the first empty slot at or after pos (cyclically). There must be at
+// least one empty slot.
+size_type qfilter::find_next_empty(const size_type pos) const noexcept {
+  const auto empty = [this](size_type block) { return empty_slots(block); };
+  const size_type found = find_next_bit(pos, num_slots, empty);
+  return found != num_slots ? found : find_next_bit(0, num_slots, empty);
+}
+
+// Returns the first slot of the cluster which contains pos. That is, the last
+// slot not shifted at or before pos (cyclically).
+size_type qfilter::find_cluster_start(const size_type pos) const noexcept {
+  const auto not_shifted = [this](size_type block) {
+    return ~meta(shifted_word, block);
+  };
+  const size_type found = find_prev_bit(pos, num_slots, not_shifted);
+  return found != num_slots ? found
+                            : find_prev_bit(num_slots - 1, num_slots,
+                                            not_shifted);
+}
+
+// Returns the start of the run following the one which contains pos, which
+// must not be the last run of its cluster.
+size_type qfilter::find_next_run_start(const size_type pos) const noexcept {
+  const auto not_continuation = [this](size_type block) {
+    return ~meta(continuation_word, block);
+  };
+  const size_type next = incr_pos(pos);
+  const size_type found = find_next_bit(next, num_slots, not_continuation);
+  return found != num_slots ? found
+                            : find_next_bit(0, num_slots, not_continuation);
 }
 
 // Find the position of the first slot of the run with the given canonical pos.
 // The run must exists.
 size_type qfilter::find_run_start(const size_type canonical_pos) const
     noexcept {
-  assert(is_occupied[canonical_pos]);
+  assert(is_occupied(canonical_pos));
+
+  // If the run is in its canonical slot returns pos immediately.
+  if (!is_shifted(canonical_pos))
+    return canonical_pos;
+
+  // If a cluster could wrap around up to the block where it begins, the
+  // offsets do not tell which runs belong to the block.
+  if (num_elements + bits_per_block > num_slots)
+    return walk_to_run_start(canonical_pos);
+
+  const size_type num_blocks = ceil_div(num_slots, bits_per_block);
+  const size_type pos = select_run_start(canonical_pos, num_blocks + 1);
+  assert(pos != num_slots && "The run must exist");
+  return pos != num_slots ? pos : canonical_pos;
+}
+
+// Returns the n-th run start at or after the beginning of the block of
+// canonical_pos, looking at no more than max_blocks blocks, or num_slots if it
+// is not found. Nothing is read out of those blocks.
+//
+// The runs of a cluster are stored in the same order as their quotients. So,
+// the run of canonical_pos is the n-th run starting at or after the beginning
+// of its block, where n is the number of runs pending at the beginning of the
+// block (its offset) plus the number of occupied quotients located before
+// canonical_pos in the same block. If the run does not exist, that is where it
+// would begin if the cluster were long enough.
+size_type qfilter::select_run_start(const size_type canonical_pos,
+                                    const size_type max_blocks) const
+    noexcept {
+  const size_type num_blocks = ceil_div(num_slots, bits_per_block);
+  size_type block = canonical_pos / bits_per_block;
+  const value_type occupied_before =
+      meta(occupied_word, block) & low_mask(canonical_pos % bits_per_block);
+  size_type n = static_cast<size_type>(meta(offset_word, block)) +
+                popcount(occupied_before);
+
+  for (size_type i = 0; i != max_blocks; ++i) {
+    const value_type starts = run_starts(block);
+    const size_type num_starts = popcount(starts);
+    if (n < num_starts) {
+      return block * bits_per_block + select_bit(starts, n);
+    }
+    n -= num_starts;
+    block = (block + 1) % num_blocks;
+  }
+  return num_slots;
+}
+
+// Finds where the run of the given canonical pos must be created. The slot at
+// canonical_pos must be non-empty and the run must not exist yet, although it
+// must be already marked as occupied.
+//
+// The new run goes where the next run begins, unless that is after the end of
+// the cluster. In such case, the new run goes to the end of the cluster. Only
+// the blocks up to the end of the cluster are read.
+size_type qfilter::find_new_run_start(const size_type canonical_pos) const
+    noexcept {
+  assert(!is_empty_slot(canonical_pos));
+  const size_type next_empty = find_next_empty(canonical_pos);
+  const auto mask = static_cast<size_type>(quotient_mask);
+
+  size_type next_run;
+  if (num_elements + bits_per_block > num_slots) {
+    next_run = find_run_start(canonical_pos);
+  } else {
+    const size_type num_blocks = ceil_div(num_slots, bits_per_block);
+    const size_type first_block = canonical_pos / bits_per_block;
+    const size_type last_block = next_empty / bits_per_block;
+    const size_type max_blocks =
+        (last_block + num_blocks - first_block) % num_blocks + 1;
+    next_run = select_run_start(canonical_pos, max_blocks);
+    if (next_run == num_slots)
+      return next_empty;
+  }
+
+  const size_type run_distance = (next_run - canonical_pos) & mask;
+  const size_type empty_distance = (next_empty - canonical_pos) & mask;
+  return run_distance < empty_distance ? next_run : next_empty;
+}
+
+// Same as find_run_start but walks back to the beginning of the cluster and
+// then forward run by run.
+size_type qfilter::walk_to_run_start(const size_type canonical_pos) const
+    noexcept {
+  assert(is_occupied(canonical_pos));
   size_type pos = canonical_pos;
 
   // If the run is in its canonical slot returns pos immediately.
-  if (!is_shifted[pos])
+  if (!is_shifted(pos))
     return pos;
 
-  do
-    pos = decr_pos(pos);
-  while (is_shifted[pos]);
+  pos = find_cluster_start(pos);
 
   size_type quotient_pos = pos;
   while (quotient_pos != canonical_pos) {
-    do
-      pos = incr_pos(pos);
-    while (is_continuation[pos]);
-
+    pos = find_next_run_start(pos);
     quotient_pos = find_next_occupied(quotient_pos);
   }
 
   return pos;
 }
 
+// Returns the number of slots of the run starting at run_start.
+size_type qfilter::run_length(const size_type run_start) const noexcept {
+  const auto mask = static_cast<size_type>(quotient_mask);
+  const size_type length = (find_next_run_start(run_start) - run_start) & mask;
+  return length != 0 ? length : num_slots; // The run could fill the filter.
+}
+
+// Returns the offset of the first remainder of the given run which is not
+// less than 'remainder', or 'length' if there is no such remainder.
+//
+// Long runs of 8 or 16 bits remainders are compared one block at a time with
+// the vectorized kernels of run_search.hpp.
+size_type qfilter::lower_bound_in_run(const size_type run_start,
+                                      const size_type length,
+                                      const value_type remainder) const
+    noexcept {
+  constexpr size_type min_vectorized_length = 8;
+  const bool vectorize = native_remainders &&
+                         bits_per_block == detail::remainders_per_block &&
+                         (r_bits == 8 || r_bits == 16) &&
+                         length >= min_vectorized_length;
+
+  size_type pos = run_start;
+  size_type offset = 0;
+
+  if (!vectorize) {
+    for (; offset != length; ++offset, pos = incr_pos(pos))
+      if (get_remainder(pos) >= remainder)
+        break;
+    return offset;
+  }
+
+  while (offset != length) {
+    const size_type block = pos / bits_per_block;
+    const size_type first = pos % bits_per_block;
+    const size_type block_end = std::min(bits_per_block, num_slots);
+    const size_type last = std::min(block_end, first + (length - offset));
+
+    const auto data =
+        reinterpret_cast<const unsigned char *>(remainders(block));
+    const size_type found =
+        r_bits == 8
+            ? detail::lower_bound_u8(data, first, last,
+                                     static_cast<std::uint8_t>(remainder))
+            : detail::lower_bound_u16(data, first, last,
+                                      static_cast<std::uint16_t>(remainder));
+
+    offset += found - first;
+    if (found != last)
+      break;
+    pos = (block * bits_per_block + last) & quotient_mask;
+  }
+  return offset;
+}
+
 iterator qfilter::find(const value_type fp) const noexcept {
 
-  // It is necessary because if *this was default constructed. All flags
-  // vectors are empty.
+  // It is necessary because if *this was default constructed. The storage is
+  // empty.
   if (empty())
     return end();
 
@@ -218,22 +958,40 @@ iterator qfilter::find(const value_type fp) const noexcept {
   const auto canonical_pos = static_cast<size_type>(fp_quotient);
 
   // If the quotient has no run, fp can't exist.
-  if (!is_occupied[canonical_pos])
+  if (!is_occupied(canonical_pos))
     return end();
 
   // Search on the sorted run for fp_remainder.
-  size_type pos = find_run_start(canonical_pos);
-  do {
-    const auto remainder = get_remainder(pos);
-    if (remainder == fp_remainder)
-      return iterator{this, pos, canonical_pos};
-    if (remainder > fp_remainder)
-      return end();
-    pos = incr_pos(pos);
-  } while (is_continuation[pos]);
+  const size_type run_start = find_run_start(canonical_pos);
+  const size_type length = run_length(run_start);
+  const size_type offset = lower_bound_in_run(run_start, length, fp_remainder);
+  const size_type pos = (run_start + offset) & quotient_mask;
+  if (offset != length && get_remainder(pos) == fp_remainder)
+    return iterator{this, pos, canonical_pos};
   return end();
 }
 
+// Requests the cache lines read by a lookup of fp, without waiting for them.
+void qfilter::prefetch(const value_type fp) const noexcept {
+#if defined(__GNUC__)
+  if (empty())
+    return;
+
+  const auto pos = static_cast<size_type>(extract_quotient(fp));
+  const size_type block = pos / bits_per_block;
+  const size_type slot = pos % bits_per_block;
+
+  __builtin_prefetch(&meta(occupied_word, block));
+  if (layout_ == slot_layout::separate) {
+    __builtin_prefetch(&meta(continuation_word, block));
+    __builtin_prefetch(&meta(shifted_word, block));
+  }
+  __builtin_prefetch(remainders(block) + r_bits * slot / bits_per_block);
+#else
+  static_cast<void>(fp);
+#endif
+}
+
 // ==========================================
 // Insertion
 // ==========================================
@@ -242,18 +1000,48 @@ iterator qfilter::find(const value_type fp) const noexcept {
 // the first empty slot one position to the right. The inserted and the moved
 // elements are marked as shifted. Note that the inserted element could actually
 // not be shifted so it should be corrected outside.
-void qfilter::insert_into(size_type pos, value_type remainder,
-                          bool continuation) noexcept {
-
-  bool found_empty_slot = false;
+// Returns the position of the slot that was empty.
+size_type qfilter::insert_into(const size_type pos, const value_type remainder,
+                               const bool continuation) noexcept {
+  const size_type empty_pos = find_next_empty(pos);
+
+  shift_slots_right(pos, empty_pos);
+  set_flag(continuation_word, pos, continuation);
+  set_remainder(pos, remainder);
+
+  if (pos <= empty_pos) {
+    set_flags(shifted_word, pos, empty_pos);
+  } else {
+    set_flags(shifted_word, pos, num_slots - 1);
+    set_flags(shifted_word, 0, empty_pos);
+  }
+  return empty_pos;
+}
 
-  do {
-    found_empty_slot = is_empty_slot(pos);
-    continuation = exchange(is_continuation[pos], continuation);
-    remainder = exchange_remainder(pos, remainder);
-    is_shifted[pos] = true;
-    pos = incr_pos(pos);
-  } while (!found_empty_slot);
+// Inserts a remainder at the given offset of the run of canonical_pos, which
+// starts at run_start. The offset could be the length of the run.
+//
+// If the run did not exist, it must be already marked as occupied, run_start
+// must be given by find_new_run_start and the offset must be zero.
+//
+// The element count is left to the caller, so the slots can be managed by
+// filters which keep their own count.
+void qfilter::insert_slot(const size_type canonical_pos,
+                          const size_type run_start, const size_type offset,
+                          const value_type remainder,
+                          const bool new_run) noexcept {
+  assert(!full());
+  assert(!new_run || offset == 0);
+  const size_type pos = (run_start + offset) & quotient_mask;
+
+  // The current head of the run will be moved to the next slot.
+  if (!new_run && offset == 0)
+    set_flag(continuation_word, pos, true);
+
+  const size_type last_pos = insert_into(pos, remainder, offset != 0);
+  if (pos == canonical_pos)
+    set_flag(shifted_word, pos, false);
+  update_offsets(canonical_pos, last_pos);
 }
 
 std::pair<iterator, bool> qfilter::insert(const value_type fp) {
@@ -266,39 +1054,522 @@ std::pair<iterator, bool> qfilter::insert(const value_type fp) {
   const auto canonical_pos = static_cast<size_type>(fp_quotient);
 
   if (is_empty_slot(canonical_pos)) {
-    is_occupied[canonical_pos] = true;
+    set_flag(occupied_word, canonical_pos, true);
     set_remainder(canonical_pos, fp_remainder);
     ++num_elements;
     return make_pair(iterator{this, canonical_pos, canonical_pos}, true);
   }
 
-  const bool run_was_empty = !exchange(is_occupied[canonical_pos], true);
+  const bool run_was_empty =
+      !exchange_flag(occupied_word, canonical_pos, true);
 
-  const size_type run_start = find_run_start(canonical_pos);
-  size_type pos = run_start;
+  if (run_was_empty) {
+    const size_type run_start = find_new_run_start(canonical_pos);
+    insert_slot(canonical_pos, run_start, 0, fp_remainder, true);
+    ++num_elements;
+    return make_pair(iterator{this, run_start, canonical_pos}, true);
+  }
 
   // Search the correct position.
-  if (!run_was_empty) {
-    do {
-      const auto remainder = get_remainder(pos);
-      if (remainder == fp_remainder)
-        return make_pair(iterator{this, pos, canonical_pos}, false);
-      if (remainder > fp_remainder)
+  const size_type run_start = find_run_start(canonical_pos);
+  const size_type length = run_length(run_start);
+  const size_type offset = lower_bound_in_run(run_start, length, fp_remainder);
+  const size_type pos = (run_start + offset) & quotient_mask;
+
+  if (offset != length && get_remainder(pos) == fp_remainder)
+    return make_pair(iterator{this, pos, canonical_pos}, false);
+
+  insert_slot(canonical_pos, run_start, offset, fp_remainder, false);
+  ++num_elements;
+  return make_pair(iterator{this, pos, canonical_pos}, true);
+}
+
+// ==========================================
+// Sorted build
+// ==========================================
+
+// The fingerprints arrive in ascending order, so each one goes to the first
+// empty slot at or after its canonical slot, which is always at or after the
+// last written slot. The fingerprints whose cluster would go past the end of
+// the writable slots are inserted normally at the end.
+
+qfilter::sorted_builder::sorted_builder(quotient_filter_fp &filter_) noexcept
+    : filter{&filter_}, end_pos{filter_.num_slots} {
+  filter->clear();
+}
+
+// Builds only the slots in [first_slot, last_slot), which must be empty, from
+// fingerprints whose canonical slots are in that range. Several builders can
+// work on disjoint ranges of whole blocks at the same time.
+qfilter::sorted_builder::sorted_builder(quotient_filter_fp &filter_,
+                                        const size_type first_slot,
+                                        const size_type last_slot) noexcept
+    : filter{&filter_}, next_pos{first_slot}, end_pos{last_slot} {}
+
+void qfilter::sorted_builder::push(const value_type fp) {
+  const size_type num_pushed = num_written + overflow.size();
+  assert((num_pushed == 0 || fp >= last_fp) && "The range is not sorted");
+  if (num_pushed != 0 && fp == last_fp)
+    return; // Repeated fingerprint.
+
+  if (num_pushed == filter->num_slots)
+    throw filter_is_full();
+
+  const bool same_run =
+      num_written != 0 &&
+      filter->extract_quotient(fp) == filter->extract_quotient(last_fp);
+  last_fp = fp;
+
+  const auto canonical_pos =
+      static_cast<size_type>(filter->extract_quotient(fp));
+  assert(canonical_pos < end_pos);
+  const size_type pos = next_slot(fp);
+  if (pos == end_pos) {
+    overflow.push_back(fp);
+    return;
+  }
+
+  filter->set_flag(occupied_word, canonical_pos, true);
+  if (same_run)
+    filter->set_flag(continuation_word, pos, true);
+  if (pos != canonical_pos)
+    filter->set_flag(shifted_word, pos, true);
+  filter->set_remainder(pos, filter->extract_remainder(fp));
+
+  next_pos = pos + 1;
+  ++num_written;
+}
+
+// Returns the slot which push(fp) would write, or end_pos if fp would not fit.
+size_type qfilter::sorted_builder::next_slot(const value_type fp) const
+    noexcept {
+  if (!overflow.empty())
+    return end_pos;
+  const auto canonical_pos =
+      static_cast<size_type>(filter->extract_quotient(fp));
+  return std::max(next_pos, canonical_pos);
+}
+
+void qfilter::sorted_builder::finish() {
+  commit();
+  if (filter->num_slots == 0)
+    return;
+  filter->rebuild_offsets();
+  insert_overflow();
+}
+
+// Adds the written fingerprints to the element count of the filter. It must be
+// called once, after the last push.
+void qfilter::sorted_builder::commit() noexcept {
+  filter->num_elements += num_written;
+}
+
+// Inserts the fingerprints which did not fit. The offsets of the filter must
+// be up to date.
+void qfilter::sorted_builder::insert_overflow() {
+  for (const value_type fp : overflow)
+    filter->insert(fp);
+  overflow.clear();
+}
+
+// ==========================================
+// Parallel build
+// ==========================================
+
+// The fingerprints are radix-partitioned by the highest bits of their
+// quotients. Every partition maps to a range of whole blocks, so the threads
+// never write the same word. Then, each partition is sorted and written by a
+// sorted_builder. The clusters which straddle the end of a range are cut
+// there, so the filter is consistent once the offsets are rebuilt, and the
+// fingerprints which were cut are inserted at the end.
+void qfilter::assign_parallel(std::vector<value_type> fingerprints,
+                              unsigned num_threads) {
+  clear();
+  if (num_slots == 0) {
+    if (!fingerprints.empty())
+      throw filter_is_full();
+    return;
+  }
+
+  num_threads = detail::thread_count(num_threads);
+  const size_type n = fingerprints.size();
+
+  // A few partitions per thread balance the work.
+  const size_type num_blocks = ceil_div(num_slots, bits_per_block);
+  size_type part_bits = 0;
+  while ((size_type{1} << part_bits) < 4 * size_type{num_threads} &&
+         (size_type{2} << part_bits) <= num_blocks)
+    ++part_bits;
+  const size_type num_parts = size_type{1} << part_bits;
+  const size_type part_slots = num_slots >> part_bits;
+  const size_type part_shift = q_bits + r_bits - part_bits;
+
+  // Every thread counts the fingerprints of its chunk which go to each
+  // partition and then scatters them after those of the previous threads.
+  std::vector<size_type> starts(num_threads * num_parts + 1);
+  const auto part_of = [part_bits, part_shift](value_type fp) {
+    return part_bits == 0 ? 0 : static_cast<size_type>(fp >> part_shift);
+  };
+  detail::run_parallel(num_threads, [&](unsigned t) {
+    const size_type last = detail::chunk_begin(n, num_threads, t + 1);
+    for (size_type i = detail::chunk_begin(n, num_threads, t); i != last; ++i)
+      ++starts[part_of(fingerprints[i]) * num_threads + t + 1];
+  });
+  for (size_type i = 1; i != starts.size(); ++i)
+    starts[i] += starts[i - 1];
+
+  std::vector<value_type> partitioned(n);
+  detail::run_parallel(num_threads, [&](unsigned t) {
+    std::vector<size_type> next(num_parts);
+    for (size_type p = 0; p != num_parts; ++p)
+      next[p] = starts[p * num_threads + t];
+    const size_type last = detail::chunk_begin(n, num_threads, t + 1);
+    for (size_type i = detail::chunk_begin(n, num_threads, t); i != last; ++i)
+      partitioned[next[part_of(fingerprints[i])]++] = fingerprints[i];
+  });
+  std::vector<value_type>().swap(fingerprints);
+
+  std::vector<sorted_builder> builders;
+  builders.reserve(num_parts);
+  for (size_type p = 0; p != num_parts; ++p)
+    builders.emplace_back(*this, p * part_slots, (p + 1) * part_slots);
+
+  try {
+    std::atomic<size_type> next_part{0};
+    detail::run_parallel(num_threads, [&](unsigned) {
+      size_type p;
+      while ((p = next_part++) < num_parts) {
+        const auto first = partitioned.begin() +
+                           static_cast<std::ptrdiff_t>(starts[p * num_threads]);
+        const auto last =
+            partitioned.begin() +
+            static_cast<std::ptrdiff_t>(starts[(p + 1) * num_threads]);
+        std::sort(first, last);
+        std::for_each(first, last,
+                      [&](value_type fp) { builders[p].push(fp); });
+      }
+    });
+
+    for (auto &builder : builders)
+      builder.commit();
+    rebuild_offsets();
+    for (auto &builder : builders)
+      builder.insert_overflow();
+  } catch (...) {
+    clear();
+    throw;
+  }
+}
+
+
+// ==========================================
+// Expansion
+// ==========================================
+
+namespace {
+
+// Reads the fingerprints of a filter which is being expanded, in ascending
+// order, from a copy of its flags and its remainders packed one after another.
+// The slots are read from the first one which is not shifted. The slots before
+// it belong to a cluster which wraps around the end, so they are decoded in
+// advance: the runs of that cluster whose quotients also wrapped around are
+// read first and the others at last.
+class expansion_reader {
+public:
+  expansion_reader(std::vector<value_type> flags_, const value_type *packed_,
+                   const size_type q_bits, const size_type r_bits_)
+      : flags(std::move(flags_)), packed{packed_}, r_bits{r_bits_},
+        num_slots{size_type{1} << q_bits},
+        num_blocks{ceil_div(num_slots, bits_per_block)} {
+    const auto not_shifted = [this](size_type block) {
+      return ~flags[shifted_flags * num_blocks + block];
+    };
+    next_pos = find_next_bit(0, num_slots, not_shifted);
+    if (next_pos == 0)
+      return;
+
+    const size_type cluster_start =
+        find_prev_bit(num_slots - 1, num_slots, not_shifted);
+    size_type run_quotient = 0;
+    for (size_type pos = cluster_start; pos != num_slots; ++pos)
+      decode(pos, run_quotient);
+    for (size_type pos = 0; pos != next_pos; ++pos) {
+      const value_type fp = decode(pos, run_quotient);
+      (run_quotient < cluster_start ? low_wrapped : high_wrapped).push_back(fp);
+    }
+  }
+
+  // Returns the first slot whose remainder has not been read yet, or
+  // num_slots if all of them have been read.
+  size_type unread_slot() const noexcept { return next_pos; }
+
+  // Reads the next fingerprint. Returns false if there are no more.
+  bool next(value_type &fp) {
+    if (next_low != low_wrapped.size()) {
+      fp = low_wrapped[next_low++];
+      return true;
+    }
+    for (; next_pos != num_slots; ++next_pos) {
+      if (!is_empty(next_pos)) {
+        fp = decode(next_pos++, quotient);
+        return true;
+      }
+    }
+    if (next_high == high_wrapped.size())
+      return false;
+    fp = high_wrapped[next_high++];
+    return true;
+  }
+
+private:
+  enum flag_kind : size_type { occupied_flags, continuation_flags,
+                               shifted_flags };
+
+  bool get_flag(const flag_kind kind, const size_type pos) const noexcept {
+    const value_type word = flags[kind * num_blocks + pos / bits_per_block];
+    return (word >> (pos % bits_per_block)) & 1;
+  }
+
+  bool is_empty(const size_type pos) const noexcept {
+    return !get_flag(occupied_flags, pos) &&
+           !get_flag(continuation_flags, pos) &&
+           !get_flag(shifted_flags, pos);
+  }
+
+  // Returns the fingerprint of the non-empty slot pos, given the quotient of
+  // the run of the previous slot, which is updated.
+  value_type decode(const size_type pos, size_type &run_quotient) const
+      noexcept {
+    const auto occupied = [this](size_type block) {
+      return flags[occupied_flags * num_blocks + block];
+    };
+    if (!get_flag(shifted_flags, pos)) {
+      run_quotient = pos;
+    } else if (!get_flag(continuation_flags, pos)) {
+      run_quotient = find_next_bit(run_quotient + 1, num_slots, occupied);
+      if (run_quotient == num_slots)
+        run_quotient = find_next_bit(0, num_slots, occupied);
+    }
+    const value_type remainder = read_bits(packed, pos * r_bits, r_bits);
+    return value_type{run_quotient} << r_bits | remainder;
+  }
+
+  std::vector<value_type> flags; // Occupied, continuation and shifted words.
+  const value_type *packed;      // The remainders.
+  size_type r_bits;
+  size_type num_slots;
+  size_type num_blocks;
+  size_type next_pos = 0; // The next slot to read.
+  size_type quotient = 0; // The quotient of the last read run.
+
+  // The fingerprints of the slots before the first one which is not shifted,
+  // whose quotients are lower or higher than the other ones.
+  std::vector<value_type> low_wrapped;
+  std::vector<value_type> high_wrapped;
+  size_type next_low = 0;
+  size_type next_high = 0;
+};
+
+} // end anonymous namespace
+
+// The slots are redistributed inside the words of the filter, which are grown
+// to the size of the expanded filter.
+//
+// First, the occupied, continuation and shifted words are copied aside and
+// the remainders are packed at the end of the words. Then, the fingerprints
+// are written in ascending order, as assign_sorted does. The words of each
+// block are zeroed just before its first slot is written, and the packed
+// remainders which are stored below the end of the block are read in advance.
+// Since an element of the expanded filter is never more than two slots after
+// the double of its old slot, only a few remainders are read in advance, and
+// the extra memory is mostly the copy of the flags: 3 words per 64 slots.
+void qfilter::expand() {
+  assert(r_bits > 1 && "The remainder must keep at least one bit");
+  const size_type old_q_bits = q_bits;
+  const size_type old_r_bits = r_bits;
+  const size_type old_blocks = ceil_div(num_slots, bits_per_block);
+
+  std::vector<value_type> flags(3 * old_blocks);
+  for (size_type block = 0; block != old_blocks; ++block) {
+    flags[block] = meta(occupied_word, block);
+    flags[old_blocks + block] = meta(continuation_word, block);
+    flags[2 * old_blocks + block] = meta(shifted_word, block);
+  }
+
+  quotient_filter_fp expanded(q_bits + 1, r_bits - 1, layout_, false);
+  const size_type work_words = std::max(words.size(), expanded.storage_words());
+  words.resize(work_words);
+
+  // Each block has exactly r_bits words of remainders. Their new place is
+  // never before the old one, so the highest blocks are moved first.
+  const size_type packed_base = work_words - old_blocks * old_r_bits;
+  for (size_type block = old_blocks; block-- != 0;)
+    std::memmove(&words[packed_base + block * old_r_bits], remainders(block),
+                 old_r_bits * sizeof(value_type));
+
+  expanded.words = std::move(words);
+  *this = std::move(expanded);
+
+  try {
+    expansion_reader reader(std::move(flags), &words[packed_base], old_q_bits,
+                            old_r_bits);
+    std::deque<value_type> read_ahead;
+    size_type zeroed_words = 0;
+
+    // Zeroes the words up to the given one, reading first the fingerprints
+    // whose remainders are stored there.
+    const auto zero_words = [&](const size_type last_word) {
+      while (reader.unread_slot() != (size_type{1} << old_q_bits) &&
+             packed_base + reader.unread_slot() * old_r_bits / bits_per_block <
+                 last_word) {
+        value_type fp;
+        reader.next(fp);
+        read_ahead.push_back(fp);
+      }
+      if (zeroed_words < last_word) {
+        std::fill(&words[zeroed_words], &words[0] + last_word, value_type{0});
+        zeroed_words = last_word;
+      }
+    };
+
+    sorted_builder builder(*this, 0, num_slots);
+    value_type fp;
+    while (true) {
+      if (!read_ahead.empty()) {
+        fp = read_ahead.front();
+        read_ahead.pop_front();
+      } else if (!reader.next(fp)) {
         break;
-      pos = incr_pos(pos);
-    } while (is_continuation[pos]);
+      }
+      const size_type pos = builder.next_slot(fp);
+      if (pos != num_slots) {
+        const size_type block = pos / bits_per_block;
+        zero_words(remainders_base + block * remainders_stride + r_bits);
+      }
+      builder.push(fp);
+    }
+    zero_words(work_words);
+    words.resize(storage_words());
+    builder.finish();
+  } catch (...) {
+    clear();
+    words.resize(storage_words());
+    throw;
+  }
+}
+
+void qfilter::shrink() {
+  assert(q_bits > 0 && "The filter has a single slot");
+  if (size() > capacity() / 2)
+    throw filter_is_full();
+  quotient_filter_fp shrunk(q_bits - 1, r_bits + 1, layout_);
+  shrunk.assign_sorted(begin(), end());
+  *this = std::move(shrunk);
+}
 
-    if (pos == run_start) {
-      is_continuation[pos] = true;
+// ==========================================
+// Set operations
+// ==========================================
+
+// Both filters are iterated in ascending order of fingerprints, so they can be
+// merge-joined and the selected fingerprints streamed into a new filter.
+void qfilter::assign_merged(const quotient_filter_fp &lhs,
+                            const quotient_filter_fp &rhs,
+                            const unsigned keep) {
+  assert((lhs.empty() || lhs.q_bits + lhs.r_bits == q_bits + r_bits) &&
+         (rhs.empty() || rhs.q_bits + rhs.r_bits == q_bits + r_bits) &&
+         "The fingerprints must have the same number of bits");
+
+  quotient_filter_fp result(q_bits, r_bits, layout_);
+  sorted_builder builder(result);
+
+  auto lhs_it = lhs.begin();
+  auto rhs_it = rhs.begin();
+  while (lhs_it != lhs.end() && rhs_it != rhs.end()) {
+    const value_type lhs_fp = *lhs_it;
+    const value_type rhs_fp = *rhs_it;
+    if (lhs_fp < rhs_fp) {
+      if (keep & keep_lhs_only)
+        builder.push(lhs_fp);
+      ++lhs_it;
+    } else if (rhs_fp < lhs_fp) {
+      if (keep & keep_rhs_only)
+        builder.push(rhs_fp);
+      ++rhs_it;
+    } else {
+      if (keep & keep_common)
+        builder.push(lhs_fp);
+      ++lhs_it;
+      ++rhs_it;
     }
   }
+  if (keep & keep_lhs_only)
+    for (; lhs_it != lhs.end(); ++lhs_it)
+      builder.push(*lhs_it);
+  if (keep & keep_rhs_only)
+    for (; rhs_it != rhs.end(); ++rhs_it)
+      builder.push(*rhs_it);
+
+  builder.finish();
+  *this = std::move(result);
+}
 
-  insert_into(pos, fp_remainder, pos != run_start);
-  if (pos == canonical_pos)
-    is_shifted[pos] = false;
+void qfilter::assign_union(const quotient_filter_fp &lhs,
+                           const quotient_filter_fp &rhs) {
+  assign_merged(lhs, rhs, keep_lhs_only | keep_rhs_only | keep_common);
+}
 
-  ++num_elements;
-  return make_pair(iterator{this, pos, canonical_pos}, true);
+void qfilter::assign_intersection(const quotient_filter_fp &lhs,
+                                  const quotient_filter_fp &rhs) {
+  assign_merged(lhs, rhs, keep_common);
+}
+
+void qfilter::assign_difference(const quotient_filter_fp &lhs,
+                                const quotient_filter_fp &rhs) {
+  assign_merged(lhs, rhs, keep_lhs_only);
+}
+
+qfilter quofil::union_of(const quotient_filter_fp &lhs,
+                         const quotient_filter_fp &rhs) {
+  if (rhs.capacity() == 0)
+    return lhs;
+  if (lhs.capacity() == 0)
+    return rhs;
+
+  const size_type fp_bits = lhs.quotient_bits() + lhs.remainder_bits();
+  assert(fp_bits == rhs.quotient_bits() + rhs.remainder_bits() &&
+         "The fingerprints must have the same number of bits");
+
+  const size_type max_size = lhs.size() + rhs.size();
+  size_type q_bits = std::max(lhs.quotient_bits(), rhs.quotient_bits());
+  while ((size_type{1} << q_bits) < max_size && q_bits + 1 < fp_bits)
+    ++q_bits;
+
+  quotient_filter_fp result(q_bits, fp_bits - q_bits, lhs.layout());
+  result.assign_union(lhs, rhs);
+  return result;
+}
+
+// The result is never bigger than lhs, so it can use the same slots.
+
+qfilter quofil::intersection_of(const quotient_filter_fp &lhs,
+                                const quotient_filter_fp &rhs) {
+  if (lhs.capacity() == 0)
+    return lhs;
+  quotient_filter_fp result(lhs.quotient_bits(), lhs.remainder_bits(),
+                            lhs.layout());
+  result.assign_intersection(lhs, rhs);
+  return result;
+}
+
+qfilter quofil::difference_of(const quotient_filter_fp &lhs,
+                              const quotient_filter_fp &rhs) {
+  if (lhs.capacity() == 0)
+    return lhs;
+  quotient_filter_fp result(lhs.quotient_bits(), lhs.remainder_bits(),
+                            lhs.layout());
+  result.assign_difference(lhs, rhs);
+  return result;
 }
 
 // ==========================================
@@ -306,60 +1577,159 @@ std::pair<iterator, bool> qfilter::insert(const value_type fp) {
 // ==========================================
 
 void qfilter::clear() noexcept {
-  std::fill(is_occupied.begin(), is_occupied.end(), false);
-  std::fill(is_continuation.begin(), is_continuation.end(), false);
-  std::fill(is_shifted.begin(), is_shifted.end(), false);
+  const size_type num_blocks = ceil_div(num_slots, bits_per_block);
+  for (size_type block = 0; block != num_blocks; ++block) {
+    meta(occupied_word, block) = 0;
+    meta(continuation_word, block) = 0;
+    meta(shifted_word, block) = 0;
+    meta(offset_word, block) = 0;
+  }
   num_elements = 0;
 }
 
 void qfilter::remove_entry(const size_type remove_pos,
                            const size_type canonical_pos) noexcept {
   assert(!is_empty_slot(remove_pos));
-  assert(is_occupied[canonical_pos]);
-
-  const bool was_head = !is_continuation[remove_pos];
-
-  size_type pos = remove_pos;             // Current position.
-  size_type quotient_pos = canonical_pos; // Quotient of the current posistion.
-
-  // First, move the elements to the left.
-  while (true) {
-    const size_type next_pos = incr_pos(pos);
-
-    if (!is_shifted[next_pos])
-      break;
-
-    set_remainder(pos, get_remainder(next_pos));
-    is_continuation[pos] = is_continuation[next_pos];
-
-    // Check for possible new cluster.
-    if (!is_continuation[pos]) {
+  assert(is_occupied(canonical_pos));
+
+  const bool was_head = !is_continuation(remove_pos);
+
+  // The elements until the next slot which is not shifted are moved to the
+  // left. Such slot always exists, although it could be remove_pos itself.
+  const auto not_shifted = [this](size_type block) {
+    return ~meta(shifted_word, block);
+  };
+  size_type end_pos = find_next_bit(incr_pos(remove_pos), num_slots,
+                                    not_shifted);
+  if (end_pos == num_slots)
+    end_pos = find_next_bit(0, num_slots, not_shifted);
+
+  // The last slot of the moved elements.
+  const size_type pos = decr_pos(end_pos);
+  shift_slots_left(remove_pos, pos);
+
+  // The runs which were moved could have reached their canonical slots. The
+  // quotients of the moved runs are the occupied slots following
+  // canonical_pos, in the same order.
+  const auto run_heads = [this](size_type block) {
+    return ~meta(continuation_word, block);
+  };
+  size_type quotient_pos = canonical_pos; // Quotient of the current run.
+  const auto fix_shifted = [&](size_type first, const size_type last) {
+    while ((first = find_next_bit(first, last, run_heads)) != last) {
       quotient_pos = find_next_occupied(quotient_pos);
-      assert(quotient_pos != next_pos && "The run was supposed to be shifted");
-      if (quotient_pos == pos)
-        is_shifted[pos] = false;
+      if (quotient_pos == first)
+        set_flag(shifted_word, first, false);
+      ++first;
     }
-
-    pos = next_pos;
+  };
+  if (remove_pos <= pos) {
+    fix_shifted(remove_pos, pos);
+  } else {
+    fix_shifted(remove_pos, num_slots);
+    fix_shifted(0, pos);
   }
 
   // Now the variable 'pos' points to the last slot of the cluster.
   // The last slot becomes empty.
-  is_shifted[pos] = false;
-  is_continuation[pos] = false;
+  set_flag(shifted_word, pos, false);
+  set_flag(continuation_word, pos, false);
 
   // The last element of a cluster is never ocuppied at least it is the only
   // element on the cluster.
-  assert(!is_occupied[pos] || pos == remove_pos && pos == canonical_pos);
+  assert(!is_occupied(pos) || (pos == remove_pos && pos == canonical_pos));
 
   if (was_head) {
-    if (is_continuation[remove_pos])
-      is_continuation[remove_pos] = false; // And the run still exists.
+    if (is_continuation(remove_pos)) // And the run still exists.
+      set_flag(continuation_word, remove_pos, false);
     else
-      is_occupied[canonical_pos] = false;
+      set_flag(occupied_word, canonical_pos, false);
   }
-  // is_shifted[remove_pos] could be true or false. Anyway, the new occupant
-  // takes the role so is_shifted[remove_pos] remains unmodificated.
+  // is_shifted(remove_pos) could be true or false. Anyway, the new occupant
+  // takes the role so is_shifted(remove_pos) remains unmodificated.
+
+  update_offsets(canonical_pos, pos);
+}
+
+// ==========================================
+// Serialization
+// ==========================================
+
+using quofil::detail::file_header;
+
+// Checks the header of a stored filter and returns the filter it describes,
+// without its words. The caller must check the number of words.
+qfilter qfilter::from_header(const void *const data,
+                             const std::uint64_t hash_tag) {
+  file_header header;
+  std::memcpy(&header, data, sizeof(header));
+  quofil::detail::check_file_header(header);
+  if (header.hash_tag != hash_tag)
+    throw bad_filter_format("The quotient filter was built with another hash "
+                            "function");
+  if (header.remainder_bits == 0)
+    return qfilter(); // Zero capacity.
+
+  qfilter filter(header.quotient_bits, header.remainder_bits,
+                 static_cast<slot_layout>(header.layout), false);
+  if (header.num_words != filter.storage_words())
+    throw bad_filter_format("Wrong size of the quotient filter data");
+  filter.num_elements = header.num_elements;
+  return filter;
+}
+
+void qfilter::save(std::ostream &os, const std::uint64_t hash_tag) const {
+  const file_header header = quofil::detail::make_file_header(
+      q_bits, r_bits, layout_, num_elements, words.size(), hash_tag);
+  os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  os.write(reinterpret_cast<const char *>(words.data()),
+           static_cast<std::streamsize>(words.size() * sizeof(value_type)));
+}
+
+qfilter qfilter::load(std::istream &is, const std::uint64_t hash_tag) {
+  char header[sizeof(file_header)];
+  if (!is.read(header, sizeof(header)))
+    throw bad_filter_format("Truncated quotient filter header");
+  qfilter filter = from_header(header, hash_tag);
+
+  // The header could be corrupt, so the words are read in chunks which at most
+  // double the ones read so far. The memory taken before noticing a truncated
+  // stream stays proportional to its actual length.
+  constexpr size_type min_chunk_words = size_type{1} << 16;
+  const size_type num_words = filter.storage_words();
+  size_type read_words = 0;
+  while (read_words != num_words) {
+    const size_type chunk_end =
+        std::min(num_words, std::max(min_chunk_words, 2 * read_words));
+    filter.words.resize(chunk_end);
+    const auto chunk_bytes = (chunk_end - read_words) * sizeof(value_type);
+    if (!is.read(reinterpret_cast<char *>(filter.words.data() + read_words),
+                 static_cast<std::streamsize>(chunk_bytes)))
+      throw bad_filter_format("Truncated quotient filter data");
+    read_words = chunk_end;
+  }
+  return filter;
+}
+
+quofil::buffer_view<qfilter>
+qfilter::view_from_buffer(const void *const data, const size_type size,
+                          const std::uint64_t hash_tag) {
+  assert(reinterpret_cast<std::uintptr_t>(data) % alignof(value_type) == 0 &&
+         "The buffer is misaligned");
+  if (size < sizeof(file_header))
+    throw bad_filter_format("Truncated quotient filter header");
+  qfilter filter = from_header(data, hash_tag);
+
+  const size_type num_words = filter.storage_words();
+  if ((size - sizeof(file_header)) / sizeof(value_type) < num_words)
+    throw bad_filter_format("Truncated quotient filter data");
+  // The view only gives const access to the filter, so the words are never
+  // written.
+  const auto first = reinterpret_cast<value_type *>(
+      const_cast<char *>(static_cast<const char *>(data)) +
+      sizeof(file_header));
+  filter.words = detail::word_buffer<value_type>(first, num_words);
+  return buffer_view<qfilter>(std::move(filter));
 }
 
 // ==========================================
@@ -370,7 +1740,7 @@ iterator qfilter::begin() const noexcept {
   if (empty())
     return end();
 
-  const size_t canonical_pos = is_occupied[0] ? 0 : find_next_occupied(0);
+  const size_t canonical_pos = is_occupied(0) ? 0 : find_next_occupied(0);
   const size_t pos = find_run_start(canonical_pos);
 
   return iterator(this, pos, canonical_pos);
@@ -382,7 +1752,7 @@ void iterator::increment() noexcept {
 
   pos = filter->incr_pos(pos);
 
-  if (filter->is_continuation[pos])
+  if (filter->is_continuation(pos))
     return;
 
   canonical_pos = filter->find_next_run_quotient(canonical_pos);
@@ -394,13 +1764,13 @@ void iterator::increment() noexcept {
   }
 
   // If it is another run on the cluster.
-  if (filter->is_shifted[pos])
+  if (filter->is_shifted(pos))
     return;
 
-  if (!filter->is_occupied[pos]) {
+  if (!filter->is_occupied(pos)) {
     assert(filter->is_empty_slot(pos));
     pos = filter->find_next_occupied(pos);
   }
 
-  assert(!filter->is_shifted[pos] && !filter->is_continuation[pos]);
+  assert(!filter->is_shifted(pos) && !filter->is_continuation(pos));
 }
@@ -0,0 +1,158 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "run_search.hpp"
+#include <cassert> // for assert
+#include <cstring> // for std::memcpy
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define QUOFIL_HAS_AVX2_KERNELS 1
+#include <immintrin.h>
+#else
+#define QUOFIL_HAS_AVX2_KERNELS 0
+#endif
+
+using std::size_t;
+using std::uint8_t;
+using std::uint16_t;
+using std::uint32_t;
+using std::uint64_t;
+
+using quofil::detail::remainders_per_block;
+
+// ==========================================
+// Scalar kernels
+// ==========================================
+
+template <typename T>
+static size_t lower_bound_scalar(const unsigned char *remainders, size_t first,
+                                 const size_t last, const T value) noexcept {
+  for (; first != last; ++first) {
+    T remainder;
+    std::memcpy(&remainder, remainders + first * sizeof(T), sizeof(T));
+    if (remainder >= value)
+      break;
+  }
+  return first;
+}
+
+static size_t lower_bound_u8_scalar(const unsigned char *remainders,
+                                    size_t first, size_t last,
+                                    uint8_t value) noexcept {
+  return lower_bound_scalar(remainders, first, last, value);
+}
+
+static size_t lower_bound_u16_scalar(const unsigned char *remainders,
+                                     size_t first, size_t last,
+                                     uint16_t value) noexcept {
+  return lower_bound_scalar(remainders, first, last, value);
+}
+
+// ==========================================
+// AVX2 kernels
+// ==========================================
+
+#if QUOFIL_HAS_AVX2_KERNELS
+
+// Returns a mask with one bit per byte of the window [base, base + 32) which
+// lies in [first, last), where first and last are byte offsets.
+static uint32_t window_mask(size_t base, size_t first, size_t last) noexcept {
+  const size_t begin = first > base ? first - base : 0;
+  const size_t end = last - base < 32 ? last - base : 32;
+  const uint64_t bits = (uint64_t{1} << end) - (uint64_t{1} << begin);
+  return static_cast<uint32_t>(bits);
+}
+
+// Each window compares 32 remainders. x >= value iff max(x, value) == x.
+__attribute__((target("avx2"))) static size_t
+lower_bound_u8_avx2(const unsigned char *remainders, size_t first, size_t last,
+                    uint8_t value) noexcept {
+  const __m256i needle = _mm256_set1_epi8(static_cast<char>(value));
+  for (size_t base = first & ~size_t{31}; base < last; base += 32) {
+    const __m256i window = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(remainders + base));
+    const __m256i not_less =
+        _mm256_cmpeq_epi8(_mm256_max_epu8(window, needle), window);
+    const uint32_t mask =
+        static_cast<uint32_t>(_mm256_movemask_epi8(not_less)) &
+        window_mask(base, first, last);
+    if (mask)
+      return base + static_cast<size_t>(__builtin_ctz(mask));
+  }
+  return last;
+}
+
+// Each window compares 16 remainders. The byte mask has two bits per
+// remainder, only the lower one is kept.
+__attribute__((target("avx2"))) static size_t
+lower_bound_u16_avx2(const unsigned char *remainders, size_t first,
+                     size_t last, uint16_t value) noexcept {
+  const __m256i needle = _mm256_set1_epi16(static_cast<short>(value));
+  const size_t first_byte = 2 * first;
+  const size_t last_byte = 2 * last;
+  for (size_t base = first_byte & ~size_t{31}; base < last_byte; base += 32) {
+    const __m256i window = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(remainders + base));
+    const __m256i not_less =
+        _mm256_cmpeq_epi16(_mm256_max_epu16(window, needle), window);
+    const uint32_t mask =
+        static_cast<uint32_t>(_mm256_movemask_epi8(not_less)) &
+        window_mask(base, first_byte, last_byte) & 0x55555555u;
+    if (mask)
+      return (base + static_cast<size_t>(__builtin_ctz(mask))) / 2;
+  }
+  return last;
+}
+
+#endif // QUOFIL_HAS_AVX2_KERNELS
+
+// ==========================================
+// Dispatching
+// ==========================================
+
+using lower_bound_u8_fn = size_t (*)(const unsigned char *, size_t, size_t,
+                                     uint8_t);
+using lower_bound_u16_fn = size_t (*)(const unsigned char *, size_t, size_t,
+                                      uint16_t);
+
+static bool cpu_has_avx2() noexcept {
+#if QUOFIL_HAS_AVX2_KERNELS
+  return __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif
+}
+
+static lower_bound_u8_fn select_u8_kernel() noexcept {
+#if QUOFIL_HAS_AVX2_KERNELS
+  if (cpu_has_avx2())
+    return lower_bound_u8_avx2;
+#endif
+  return lower_bound_u8_scalar;
+}
+
+static lower_bound_u16_fn select_u16_kernel() noexcept {
+#if QUOFIL_HAS_AVX2_KERNELS
+  if (cpu_has_avx2())
+    return lower_bound_u16_avx2;
+#endif
+  return lower_bound_u16_scalar;
+}
+
+size_t quofil::detail::lower_bound_u8(const unsigned char *remainders,
+                                      size_t first, size_t last,
+                                      uint8_t value) noexcept {
+  assert(first <= last && last <= remainders_per_block);
+  static const lower_bound_u8_fn kernel = select_u8_kernel();
+  return kernel(remainders, first, last, value);
+}
+
+size_t quofil::detail::lower_bound_u16(const unsigned char *remainders,
+                                       size_t first, size_t last,
+                                       uint16_t value) noexcept {
+  assert(first <= last && last <= remainders_per_block);
+  static const lower_bound_u16_fn kernel = select_u16_kernel();
+  return kernel(remainders, first, last, value);
+}
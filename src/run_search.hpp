@@ -0,0 +1,36 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Kernels to search a sorted run of native remainders within a block of
+// slots. They use AVX2 when the running CPU supports it.
+
+#ifndef QUOFIL_SRC_RUN_SEARCH_HPP
+#define QUOFIL_SRC_RUN_SEARCH_HPP
+
+#include <cstddef> // for std::size_t
+#include <cstdint> // for std::uint{8,16}_t
+
+namespace quofil {
+namespace detail {
+
+// The number of remainders stored in a block.
+constexpr std::size_t remainders_per_block = 64;
+
+// Returns the first index in [first, last) whose remainder is not less than
+// value, or last if there is no such index.
+//
+// 'remainders' must point to the remainders of a whole block, i.e.
+// remainders_per_block integers of the corresponding width. The kernels could
+// read any of them, but only [first, last) is taken into account.
+std::size_t lower_bound_u8(const unsigned char *remainders, std::size_t first,
+                           std::size_t last, std::uint8_t value) noexcept;
+
+std::size_t lower_bound_u16(const unsigned char *remainders, std::size_t first,
+                            std::size_t last, std::uint16_t value) noexcept;
+
+} // end namespace detail
+} // end namespace quofil
+
+#endif // Header guard
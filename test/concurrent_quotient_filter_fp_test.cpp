@@ -0,0 +1,223 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <quofil/concurrent_quotient_filter_fp.hpp>
+#include <gtest/gtest.h>
+
+#include <atomic>  // for std::atomic
+#include <set>     // for std::set
+#include <thread>  // for std::thread
+#include <vector>  // for std::vector
+#include <random>  // imported names declared below.
+#include <cstddef> // imported names declared below.
+
+// ==========================================
+// Macros
+// ==========================================
+
+#ifdef FILTER_TEST
+#undef FILTER_TEST
+#endif
+#define FILTER_TEST(test_name) TEST(concurrent_quotient_filter_fp, test_name)
+
+// ==========================================
+// Imported names
+// ==========================================
+
+// From <random>
+using std::mt19937;
+using std::uniform_int_distribution;
+
+// From <cstddef>
+using std::size_t;
+
+// ==========================================
+// Type aliases
+// ==========================================
+
+using filter_t = quofil::concurrent_quotient_filter_fp;
+using value_t = filter_t::value_type;
+
+// ==========================================
+// FILTER_TEST Section
+// ==========================================
+
+FILTER_TEST(Has_the_requested_geometry) {
+  const filter_t filter(10, 8, 7); // q_bits, r_bits, region_bits
+  EXPECT_TRUE(filter.empty());
+  EXPECT_EQ(1024, filter.capacity());
+  EXPECT_EQ(128, filter.region_slots());
+  EXPECT_LT(filter.max_size(), filter.capacity());
+  EXPECT_EQ(10, filter.quotient_bits());
+  EXPECT_EQ(8, filter.remainder_bits());
+
+  EXPECT_EQ(64, filter_t(10, 8, 1).region_slots());
+  EXPECT_EQ(1024, filter_t(10, 8, 30).region_slots());
+  EXPECT_EQ(4096, filter_t(16, 8).region_slots());
+}
+
+FILTER_TEST(Behaves_like_a_set) {
+  using quofil::slot_layout;
+  for (const auto layout : {slot_layout::separate, slot_layout::blocked}) {
+    filter_t filter(10, 6, 6, layout); // q_bits, r_bits, region_bits
+    std::set<value_t> expected;
+
+    mt19937 gen(3412);
+    uniform_int_distribution<value_t> dist(0, (1 << 16) - 1);
+
+    for (size_t i = 0; i != 20000; ++i) {
+      const auto fp = dist(gen);
+      if (gen() % 3 != 0) {
+        if (filter.size() != filter.max_size()) {
+          EXPECT_EQ(expected.insert(fp).second, filter.insert(fp));
+        }
+      } else {
+        EXPECT_EQ(expected.erase(fp), filter.erase(fp));
+      }
+      EXPECT_EQ(expected.count(fp), filter.count(fp));
+    }
+    EXPECT_EQ(expected.size(), filter.size());
+    for (value_t fp = 0; fp != (1 << 16); ++fp)
+      EXPECT_EQ(expected.count(fp), filter.count(fp)) << fp;
+  }
+}
+
+FILTER_TEST(Handles_clusters_spanning_several_regions) {
+  filter_t filter(10, 10, 6); // q_bits, r_bits, region_bits
+  // A run of 200 slots from the slot 60, and another one which wraps around
+  // the end of the filter.
+  for (value_t remainder = 0; remainder != 200; ++remainder) {
+    EXPECT_TRUE(filter.insert((60 << 10) | remainder));
+    if (remainder < 100) {
+      EXPECT_TRUE(filter.insert((1000 << 10) | remainder));
+    }
+  }
+  EXPECT_TRUE(filter.insert(100 << 10)); // Goes after the first run.
+
+  for (value_t remainder = 0; remainder != 200; remainder += 2)
+    EXPECT_EQ(1, filter.erase((60 << 10) | remainder));
+
+  for (value_t remainder = 0; remainder != 200; ++remainder) {
+    EXPECT_EQ(remainder % 2, filter.count((60 << 10) | remainder));
+    EXPECT_EQ(remainder < 100, filter.count((1000 << 10) | remainder));
+  }
+  EXPECT_EQ(1, filter.count(100 << 10));
+  EXPECT_EQ(201, filter.size());
+}
+
+FILTER_TEST(Throws_when_full) {
+  filter_t filter(8, 4); // q_bits, r_bits
+  for (value_t fp = 0; filter.size() != filter.max_size(); ++fp)
+    EXPECT_TRUE(filter.insert(fp * 7));
+  EXPECT_THROW(filter.insert(1), quofil::filter_is_full);
+  EXPECT_EQ(filter.max_size(), filter.size());
+  EXPECT_EQ(1, filter.erase(0));
+  EXPECT_TRUE(filter.insert(1));
+}
+
+FILTER_TEST(Rejects_duplicates_when_full) {
+  filter_t filter(8, 4); // q_bits, r_bits
+  for (value_t fp = 0; filter.size() != filter.max_size(); ++fp)
+    EXPECT_TRUE(filter.insert(fp * 7));
+  for (value_t fp = 0; fp != filter.max_size(); ++fp)
+    EXPECT_FALSE(filter.insert(fp * 7));
+  EXPECT_THROW(filter.insert(1), quofil::filter_is_full);
+  EXPECT_EQ(filter.max_size(), filter.size());
+}
+
+FILTER_TEST(Supports_concurrent_insertions_erasures_and_lookups) {
+  constexpr size_t num_writers = 4;
+  constexpr size_t num_readers = 2;
+  constexpr value_t fps_per_writer = 2000;
+  filter_t filter(14, 10, 8); // q_bits, r_bits, region_bits
+
+  // Every writer owns the fingerprints congruent to its index. The
+  // fingerprints of the readers are inserted beforehand and never erased.
+  const auto writer_fp = [](size_t writer, value_t i) {
+    return (i * 2654435761u) % (1 << 21) * 8 + writer;
+  };
+  const auto reader_fp = [&](value_t i) { return writer_fp(num_writers, i); };
+  for (value_t i = 0; i != fps_per_writer; ++i)
+    filter.insert(reader_fp(i));
+
+  std::atomic<size_t> errors{0};
+  std::atomic<bool> done{false};
+  std::vector<std::thread> threads;
+  for (size_t w = 0; w != num_writers; ++w) {
+    threads.emplace_back([&, w] {
+      for (value_t i = 0; i != fps_per_writer; ++i)
+        if (!filter.insert(writer_fp(w, i)))
+          ++errors;
+      for (value_t i = 0; i < fps_per_writer; i += 3)
+        if (filter.erase(writer_fp(w, i)) != 1)
+          ++errors;
+    });
+  }
+  for (size_t r = 0; r != num_readers; ++r) {
+    threads.emplace_back([&] {
+      while (!done)
+        for (value_t i = 0; i != fps_per_writer; ++i)
+          if (filter.count(reader_fp(i)) != 1)
+            ++errors;
+    });
+  }
+  for (size_t t = 0; t != num_writers; ++t)
+    threads[t].join();
+  done = true;
+  for (size_t t = num_writers; t != threads.size(); ++t)
+    threads[t].join();
+
+  EXPECT_EQ(0, errors);
+  for (size_t w = 0; w != num_writers; ++w)
+    for (value_t i = 0; i != fps_per_writer; ++i)
+      EXPECT_EQ(i % 3 != 0, filter.count(writer_fp(w, i)));
+  const size_t erased_per_writer = (fps_per_writer + 2) / 3;
+  EXPECT_EQ((1 + num_writers) * fps_per_writer -
+                num_writers * erased_per_writer,
+            filter.size());
+}
+
+FILTER_TEST(Lookups_are_consistent_while_long_runs_are_modified) {
+  constexpr size_t num_readers = 3;
+  filter_t filter(10, 10, 6); // q_bits, r_bits, region_bits
+
+  // The even remainders of the run of the slot 60 are never erased, while a
+  // writer keeps inserting and erasing the odd ones, shifting the run and the
+  // following cluster back and forth across several blocks.
+  const auto fp = [](value_t remainder) { return (60 << 10) | remainder; };
+  for (value_t remainder = 0; remainder < 300; remainder += 2)
+    filter.insert(fp(remainder));
+  for (value_t quotient = 61; quotient != 70; ++quotient)
+    filter.insert(quotient << 10);
+
+  std::atomic<size_t> errors{0};
+  std::atomic<bool> done{false};
+  std::vector<std::thread> readers;
+  for (size_t r = 0; r != num_readers; ++r) {
+    readers.emplace_back([&] {
+      while (!done) {
+        for (value_t remainder = 0; remainder < 300; remainder += 2)
+          if (filter.count(fp(remainder)) != 1)
+            ++errors;
+        for (value_t quotient = 61; quotient != 70; ++quotient)
+          if (filter.count(quotient << 10) != 1)
+            ++errors;
+      }
+    });
+  }
+
+  for (size_t round = 0; round != 20; ++round) {
+    for (value_t remainder = 1; remainder < 300; remainder += 2)
+      EXPECT_TRUE(filter.insert(fp(remainder)));
+    for (value_t remainder = 1; remainder < 300; remainder += 2)
+      EXPECT_EQ(1, filter.erase(fp(remainder)));
+  }
+  done = true;
+  for (auto &reader : readers)
+    reader.join();
+
+  EXPECT_EQ(0, errors);
+  EXPECT_EQ(159, filter.size());
+}
@@ -0,0 +1,166 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <quofil/counting_quotient_filter_fp.hpp>
+#include <gtest/gtest.h>
+
+#include <map>     // for std::map
+#include <random>  // imported names declared below.
+#include <cstddef> // imported names declared below.
+
+// ==========================================
+// Macros
+// ==========================================
+
+#ifdef FILTER_TEST
+#undef FILTER_TEST
+#endif
+#define FILTER_TEST(test_name) TEST(counting_quotient_filter_fp, test_name)
+
+// ==========================================
+// Imported names
+// ==========================================
+
+// From <random>
+using std::mt19937;
+using std::uniform_int_distribution;
+
+// From <cstddef>
+using std::size_t;
+
+// ==========================================
+// Type aliases
+// ==========================================
+
+using filter_t = quofil::counting_quotient_filter_fp;
+using value_t = filter_t::value_type;
+using map_t = std::map<value_t, size_t>;
+
+// ==========================================
+// Utilities for tests.
+// ==========================================
+
+// Checks that the filter holds exactly the counts of the map.
+static void expect_counts(const map_t &counts, const filter_t &filter) {
+  size_t total = 0;
+  for (const auto &elem : counts) {
+    EXPECT_EQ(elem.second, filter.count(elem.first)) << elem.first;
+    total += elem.second;
+  }
+  EXPECT_EQ(total, filter.size());
+}
+
+// ==========================================
+// FILTER_TEST Section
+// ==========================================
+
+FILTER_TEST(Counts_repeated_insertions) {
+  filter_t filter(8, 8); // q_bits, r_bits
+  EXPECT_TRUE(filter.empty());
+  EXPECT_EQ(0, filter.count(1234));
+
+  for (size_t i = 1; i <= 1000; ++i)
+    EXPECT_EQ(i, filter.insert(1234));
+  EXPECT_EQ(1000, filter.count(1234));
+  EXPECT_EQ(1000, filter.size());
+  EXPECT_LT(filter.used_slots(), 5);
+
+  EXPECT_EQ(1, filter.insert(1235));
+  EXPECT_EQ(1, filter.insert(1233));
+  EXPECT_EQ(1002, filter.insert(1234, 2));
+  EXPECT_EQ(1, filter.count(1235));
+  EXPECT_EQ(1, filter.count(1233));
+  EXPECT_EQ(0, filter.count(1236));
+}
+
+FILTER_TEST(Singletons_take_a_single_slot) {
+  filter_t filter(10, 6); // q_bits, r_bits
+  for (value_t fp = 0; fp < 5000; fp += 7)
+    filter.insert(fp);
+  EXPECT_EQ(filter.size(), filter.used_slots());
+}
+
+FILTER_TEST(Erase_decrements_the_count) {
+  filter_t filter(6, 5); // q_bits, r_bits
+  filter.insert(100, 300);
+  filter.insert(101, 2);
+  filter.insert(99);
+
+  for (size_t i = 300; i != 0; --i) {
+    EXPECT_EQ(i, filter.count(100));
+    EXPECT_EQ(1, filter.erase(100));
+    EXPECT_EQ(2, filter.count(101));
+    EXPECT_EQ(1, filter.count(99));
+  }
+  EXPECT_EQ(0, filter.count(100));
+  EXPECT_EQ(0, filter.erase(100));
+  EXPECT_EQ(3, filter.size());
+  EXPECT_EQ(3, filter.used_slots());
+}
+
+FILTER_TEST(Handles_the_special_remainders) {
+  // The remainders 0 and 1 use unary counters.
+  filter_t filter(6, 4); // q_bits, r_bits
+  for (const value_t remainder : {0, 1, 2, 15}) {
+    SCOPED_TRACE(remainder);
+    const value_t fp = (7 << 4) | remainder;
+    filter.clear();
+    filter.insert(fp - 16); // Another run before.
+    filter.insert(fp + 16); // Another run after.
+    for (size_t i = 1; i <= 20; ++i) {
+      EXPECT_EQ(i, filter.insert(fp));
+      EXPECT_EQ(1, filter.count(fp - 16));
+      EXPECT_EQ(1, filter.count(fp + 16));
+    }
+    for (size_t i = 20; i != 0; --i) {
+      EXPECT_EQ(i, filter.count(fp));
+      filter.erase(fp);
+    }
+    EXPECT_EQ(2, filter.used_slots());
+  }
+}
+
+FILTER_TEST(Throws_when_counters_do_not_fit) {
+  filter_t filter(2, 1); // 4 slots, the remainders 0 and 1 are unary.
+  filter.insert(0, 3);
+  EXPECT_THROW(filter.insert(0, 2), quofil::filter_is_full);
+  EXPECT_EQ(3, filter.count(0));
+  EXPECT_EQ(4, filter.insert(0));
+  EXPECT_THROW(filter.insert(5), quofil::filter_is_full);
+
+  filter_t empty_filter;
+  EXPECT_THROW(empty_filter.insert(0), quofil::filter_is_full);
+  EXPECT_EQ(0, empty_filter.count(0));
+  EXPECT_EQ(0, empty_filter.erase(0));
+}
+
+FILTER_TEST(Can_mix_insertions_deletions_and_queries) {
+  using quofil::slot_layout;
+  for (const auto layout : {slot_layout::separate, slot_layout::blocked}) {
+    filter_t filter(9, 4, layout); // q_bits, r_bits
+    map_t counts;
+
+    mt19937 gen(4234);
+    uniform_int_distribution<value_t> dist(0, 1200); // Few quotients.
+    uniform_int_distribution<size_t> amount(1, 40);
+
+    for (size_t i = 0; i != 5000; ++i) {
+      const auto fp = dist(gen);
+      if (gen() % 3 != 0) {
+        const auto n = amount(gen);
+        if (filter.used_slots() + 8 < filter.capacity()) {
+          counts[fp] += n;
+          EXPECT_EQ(counts[fp], filter.insert(fp, n));
+        }
+      } else {
+        const size_t erased = counts[fp] != 0 ? 1 : 0;
+        counts[fp] -= erased;
+        EXPECT_EQ(erased, filter.erase(fp));
+      }
+      EXPECT_EQ(counts[fp], filter.count(fp));
+    }
+    expect_counts(counts, filter);
+  }
+}
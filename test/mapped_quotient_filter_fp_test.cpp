@@ -0,0 +1,191 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <quofil/mapped_quotient_filter_fp.hpp>
+#include <gtest/gtest.h>
+
+#include <algorithm>    // for std::equal
+#include <fstream>      // for std::fstream, std::ofstream
+#include <set>          // for std::set
+#include <string>       // for std::string
+#include <system_error> // for std::system_error
+#include <utility>      // for std::move
+#include <cstdio>       // for std::remove
+#include <random>       // imported names declared below.
+#include <cstddef>      // imported names declared below.
+
+// ==========================================
+// Macros
+// ==========================================
+
+#ifdef FILTER_TEST
+#undef FILTER_TEST
+#endif
+#define FILTER_TEST(test_name) TEST(mapped_quotient_filter_fp, test_name)
+
+// ==========================================
+// Imported names
+// ==========================================
+
+// From <random>
+using std::mt19937;
+using std::uniform_int_distribution;
+
+// From <cstddef>
+using std::size_t;
+
+// ==========================================
+// Type aliases
+// ==========================================
+
+using filter_t = quofil::mapped_quotient_filter_fp;
+using value_t = filter_t::value_type;
+
+// ==========================================
+// Helpers
+// ==========================================
+
+namespace {
+// Removes the file on destruction.
+class temp_file {
+public:
+  explicit temp_file(std::string path_) : path(std::move(path_)) {
+    std::remove(path.c_str());
+  }
+  temp_file(const temp_file &) = delete;
+  temp_file &operator=(const temp_file &) = delete;
+  ~temp_file() { std::remove(path.c_str()); }
+
+  // Overwrites 'n' bytes at 'offset' with the given byte.
+  void corrupt(std::streamoff offset, size_t n, char byte) const {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(offset);
+    for (size_t i = 0; i != n; ++i)
+      file.put(byte);
+  }
+
+public:
+  const std::string path;
+};
+} // end anonymous namespace
+
+// ==========================================
+// FILTER_TEST Section
+// ==========================================
+
+FILTER_TEST(Is_empty_when_created) {
+  const temp_file file("mapped_qf_empty.qf");
+  const auto filter = filter_t::create(file.path, 10, 6);
+  EXPECT_TRUE(filter.empty());
+  EXPECT_EQ(0, filter.size());
+  EXPECT_EQ(1024, filter.capacity());
+  EXPECT_EQ(10, filter.quotient_bits());
+  EXPECT_EQ(6, filter.remainder_bits());
+  EXPECT_EQ(quofil::slot_layout::separate, filter.layout());
+  EXPECT_EQ(filter.end(), filter.begin());
+}
+
+FILTER_TEST(Keeps_the_elements_after_reopening) {
+  using quofil::slot_layout;
+  for (const auto layout : {slot_layout::separate, slot_layout::blocked}) {
+    const temp_file file("mapped_qf_reopen.qf");
+    std::set<value_t> expected;
+    mt19937 gen(3412);
+    uniform_int_distribution<value_t> dist(0, (1 << 18) - 1);
+
+    {
+      auto filter = filter_t::create(file.path, 12, 6, layout);
+      for (size_t i = 0; i != 3000; ++i) {
+        const auto fp = dist(gen);
+        EXPECT_EQ(expected.insert(fp).second, filter.insert(fp).second);
+      }
+    }
+    {
+      auto filter = filter_t::open(file.path);
+      EXPECT_EQ(layout, filter.layout());
+      EXPECT_EQ(expected.size(), filter.size());
+      EXPECT_TRUE(std::equal(filter.begin(), filter.end(), expected.begin()));
+      for (value_t fp = 0; fp != (1 << 18); fp += 2) {
+        EXPECT_EQ(expected.count(fp), filter.erase(fp));
+        expected.erase(fp);
+      }
+      filter.sync();
+    }
+    const auto filter = filter_t::open(file.path);
+    EXPECT_EQ(expected.size(), filter.size());
+    for (value_t fp = 0; fp != (1 << 18); ++fp)
+      EXPECT_EQ(expected.count(fp), filter.count(fp)) << fp;
+  }
+}
+
+FILTER_TEST(Keeps_the_count_in_the_file_while_mapped) {
+  const temp_file file("mapped_qf_count.qf");
+  auto filter = filter_t::create(file.path, 8, 8);
+  for (value_t fp = 0; fp != 100; ++fp)
+    filter.insert(fp * 331 % (1 << 16));
+  filter.erase(331);
+  filter.erase(filter.find(662));
+
+  // Both mappings share the file, as if the first one had been abandoned.
+  EXPECT_EQ(98, filter_t::open(file.path).size());
+  filter.clear();
+  EXPECT_EQ(0, filter_t::open(file.path).size());
+}
+
+FILTER_TEST(Can_be_moved) {
+  const temp_file file("mapped_qf_move.qf");
+  auto filter = filter_t::create(file.path, 8, 8);
+  EXPECT_TRUE(filter.insert(1234).second);
+
+  filter_t other = std::move(filter);
+  EXPECT_EQ(1, other.count(1234));
+  EXPECT_TRUE(other.insert(4321).second);
+
+  const temp_file file2("mapped_qf_move2.qf");
+  filter = filter_t::create(file2.path, 8, 8);
+  filter = std::move(other);
+  EXPECT_EQ(2, filter.size());
+  EXPECT_EQ(1, filter.count(4321));
+}
+
+FILTER_TEST(Shares_the_format_of_the_filter) {
+  const temp_file file("mapped_qf_filter.qf");
+  auto filter = filter_t::create(file.path, 10, 10);
+  for (value_t fp = 0; fp != 500; ++fp)
+    filter.insert(fp * 2011 % (1 << 20));
+
+  // The copy lives in memory.
+  quofil::quotient_filter_fp copy = filter.filter();
+  filter.clear();
+  EXPECT_EQ(500, copy.size());
+  EXPECT_EQ(1, copy.count(2011));
+  EXPECT_EQ(0, filter.count(2011));
+}
+
+FILTER_TEST(Rejects_malformed_files) {
+  const temp_file file("mapped_qf_bad.qf");
+  EXPECT_THROW(filter_t::open(file.path), std::system_error);
+
+  filter_t::create(file.path, 8, 8);
+  EXPECT_NO_THROW(filter_t::open(file.path));
+
+  file.corrupt(0, 1, 'X'); // The magic number.
+  EXPECT_THROW(filter_t::open(file.path), quofil::bad_filter_format);
+
+  filter_t::create(file.path, 8, 8);
+  file.corrupt(8, 1, 9); // The version.
+  EXPECT_THROW(filter_t::open(file.path), quofil::bad_filter_format);
+
+  filter_t::create(file.path, 8, 8);
+  file.corrupt(24, 1, 20); // The quotient bits, so the size is wrong.
+  EXPECT_THROW(filter_t::open(file.path), quofil::bad_filter_format);
+
+  filter_t::create(file.path, 8, 8);
+  std::ofstream(file.path, std::ios::app | std::ios::binary).put(0);
+  EXPECT_THROW(filter_t::open(file.path), quofil::bad_filter_format);
+
+  std::ofstream(file.path, std::ios::trunc).put('Q');
+  EXPECT_THROW(filter_t::open(file.path), quofil::bad_filter_format);
+}
@@ -6,13 +6,16 @@
 #include <quofil/quotient_filter_fp.hpp>
 #include <gtest/gtest.h>
 
-#include <algorithm> // for std::equal
+#include <algorithm> // for std::{equal, fill, find}
 #include <iterator>  // for std::{begin, end, next}
 #include <random>    // imported names declared below.
+#include <sstream>   // for std::{stringstream, istringstream, ostringstream}
+#include <string>    // for std::string
 #include <utility>   // for std::move
 #include <vector>    // for std::vector
 #include <cstddef>   // imported names declared below.
-#include <cstdint>   // for SIZE_MAX
+#include <cstdint>   // for SIZE_MAX, std::uint64_t
+#include <cstring>   // for std::memcpy
 
 // ==========================================
 // Macros
@@ -146,6 +149,142 @@ FILTER_TEST(Can_mix_insertions_deletions_and_queries) {
   });
 }
 
+FILTER_TEST(Blocked_layout_behaves_like_separate_layout) {
+  filter_t separate(10, 5, quofil::slot_layout::separate);
+  filter_t blocked(10, 5, quofil::slot_layout::blocked);
+  EXPECT_EQ(quofil::slot_layout::separate, separate.layout());
+  EXPECT_EQ(quofil::slot_layout::blocked, blocked.layout());
+
+  auto gen_fp = make_fp_generator(blocked);
+  auto do_insertion = make_insertion_decision_generator(blocked);
+
+  repeat(3 * blocked.capacity(), [&] {
+    const auto fp = gen_fp();
+    if (do_insertion()) {
+      const auto pblocked = blocked.insert(fp);
+      EXPECT_EQ(separate.insert(fp).second, pblocked.second);
+      EXPECT_EQ(fp, *pblocked.first);
+    } else {
+      EXPECT_EQ(separate.erase(fp), blocked.erase(fp));
+    }
+    EXPECT_EQ(separate.size(), blocked.size());
+  });
+
+  EXPECT_TRUE(equal(separate, blocked));
+
+  repeat(10000, [&] {
+    const auto fp = gen_fp();
+    EXPECT_EQ(separate.count(fp), blocked.count(fp));
+  });
+}
+
+FILTER_TEST(Can_operate_at_high_load_factors) {
+  filter_t filter(12, 10); // q_bits, r_bits
+  const size_t max_size = filter.capacity() * 95 / 100;
+  set_t set;
+
+  auto gen_fp = make_fp_generator(filter);
+  while (set.size() != max_size) {
+    const auto fp = gen_fp();
+    EXPECT_EQ(set.insert(fp).second, filter.insert(fp).second);
+  }
+
+  repeat(filter.capacity(), [&] {
+    const auto fp = gen_fp();
+    if (filter.size() == max_size) {
+      const auto victim = *set.lower_bound(fp % *set.rbegin());
+      EXPECT_EQ(1, filter.erase(victim));
+      set.erase(victim);
+    } else {
+      EXPECT_EQ(set.insert(fp).second, filter.insert(fp).second);
+    }
+    EXPECT_EQ(set.count(fp), filter.count(fp));
+  });
+
+  EXPECT_TRUE(equal(set, filter));
+}
+
+FILTER_TEST(Supports_any_remainder_width) {
+  for (const size_t r_bits : {7, 8, 9, 16, 31, 32, 33}) {
+    SCOPED_TRACE(r_bits);
+    filter_t filter(8, r_bits); // q_bits, r_bits
+    populate(filter, filter.capacity() * 3 / 4);
+    const set_t set(filter.begin(), filter.end());
+
+    const value_t max_remainder = (value_t{1} << r_bits) - 1;
+    for (const value_t quotient : {0, 1, 100, 255}) {
+      const value_t fp = (quotient << r_bits) | max_remainder;
+      EXPECT_EQ(set.count(fp), filter.count(fp));
+      filter.insert(fp);
+      EXPECT_TRUE(filter.count(fp));
+      EXPECT_EQ(fp, *filter.find(fp));
+    }
+
+    for (const value_t fp : set)
+      EXPECT_EQ(1, filter.erase(fp));
+  }
+}
+
+FILTER_TEST(Can_search_runs_spanning_several_blocks) {
+  using quofil::slot_layout;
+  for (const auto layout : {slot_layout::separate, slot_layout::blocked}) {
+    for (const size_t r_bits : {8, 16}) {
+      SCOPED_TRACE(r_bits);
+      filter_t filter(8, r_bits, layout); // q_bits, r_bits
+      set_t set;
+
+      // Every fingerprint shares the quotient 200, so the run wraps around.
+      const value_t base = value_t{200} << r_bits;
+      mt19937 gen(4123);
+      uniform_int_distribution<value_t> dist(0, (value_t{1} << r_bits) - 1);
+
+      repeat(2 * filter.capacity(), [&] {
+        const auto fp = base | dist(gen);
+        if (filter.size() < filter.capacity() * 3 / 4) {
+          const auto pfilter = filter.insert(fp);
+          EXPECT_EQ(set.insert(fp).second, pfilter.second);
+          EXPECT_EQ(fp, *pfilter.first);
+        } else {
+          EXPECT_EQ(set.erase(fp), filter.erase(fp));
+        }
+        EXPECT_EQ(set.count(fp), filter.count(fp));
+      });
+
+      EXPECT_TRUE(equal(set, filter));
+      for (value_t remainder = 0; remainder >> r_bits == 0; remainder += 7)
+        EXPECT_EQ(set.count(base | remainder), filter.count(base | remainder));
+    }
+  }
+}
+
+FILTER_TEST(Can_look_up_many_fingerprints) {
+  filter_t filter(10, 6, quofil::slot_layout::blocked); // q_bits, r_bits
+  populate(filter, filter.capacity() / 2);
+
+  auto gen_fp = make_fp_generator(filter);
+  std::vector<value_t> fps(1000);
+  for (auto &fp : fps)
+    fp = gen_fp();
+  fps.insert(fps.end(), filter.begin(), filter.end());
+
+  std::vector<bool> counts(fps.size());
+  std::vector<filter_t::const_iterator> found(fps.size());
+  EXPECT_EQ(counts.end(), filter.count_many(fps.begin(), fps.end(),
+                                            counts.begin()));
+  EXPECT_EQ(found.end(), filter.find_many(fps.begin(), fps.end(),
+                                          found.begin()));
+
+  for (size_t i = 0; i != fps.size(); ++i) {
+    EXPECT_EQ(filter.count(fps[i]), counts[i]);
+    EXPECT_EQ(filter.find(fps[i]), found[i]);
+  }
+
+  const filter_t empty_filter;
+  EXPECT_EQ(counts.end(), empty_filter.count_many(fps.begin(), fps.end(),
+                                                  counts.begin()));
+  EXPECT_EQ(counts.end(), std::find(counts.begin(), counts.end(), true));
+}
+
 FILTER_TEST(Can_be_empty_and_full) {
 
   filter_t filter(10, 8); // q_bits, r_bits
@@ -170,6 +309,253 @@ FILTER_TEST(Can_be_empty_and_full) {
   EXPECT_TRUE(filter.empty());
 }
 
+FILTER_TEST(Can_be_built_from_sorted_fingerprints) {
+  for (const size_t q_bits : {3, 6, 10}) {
+    SCOPED_TRACE(q_bits);
+    filter_t expected(q_bits, 9); // q_bits, r_bits
+    populate(expected, expected.capacity() * 9 / 10);
+    const std::vector<value_t> fps(expected.begin(), expected.end());
+
+    filter_t built(q_bits, 9);
+    built.insert(1); // Must be replaced.
+    built.assign_sorted(fps.begin(), fps.end());
+    EXPECT_TRUE(totally_equal(expected, built));
+
+    for (const value_t fp : fps)
+      EXPECT_TRUE(built.count(fp));
+    auto gen_fp = make_fp_generator(built);
+    repeat(1000, [&] {
+      const auto fp = gen_fp();
+      EXPECT_EQ(expected.count(fp), built.count(fp));
+      if (built.full())
+        EXPECT_EQ(expected.erase(fp), built.erase(fp));
+      else
+        EXPECT_EQ(expected.insert(fp).second, built.insert(fp).second);
+    });
+    EXPECT_TRUE(equal(expected, built));
+  }
+}
+
+FILTER_TEST(Can_be_built_when_clusters_wrap_around) {
+  // Every fingerprint belongs to the last quotients, so the clusters must
+  // wrap around the end of the filter.
+  filter_t filter(6, 4); // q_bits, r_bits
+  set_t set;
+  for (value_t fp = 60 << 4; set.size() != filter.capacity(); fp += 3)
+    set.insert(fp % (64 << 4));
+
+  filter.assign_sorted(set.begin(), set.end());
+  EXPECT_TRUE(filter.full());
+  EXPECT_TRUE(equal(set, filter));
+  for (const value_t fp : set)
+    EXPECT_EQ(1, filter.erase(fp));
+  EXPECT_TRUE(filter.empty());
+}
+
+FILTER_TEST(Can_be_built_from_unsorted_fingerprints) {
+  filter_t filter(8, 8); // q_bits, r_bits
+  const std::vector<value_t> fps = {9000, 3, 9000, 65535, 0, 42, 3};
+  filter.assign(fps.begin(), fps.end());
+  EXPECT_TRUE(equal(set_t(fps.begin(), fps.end()), filter));
+
+  const std::vector<value_t> too_many(filter.capacity() + 1, 7);
+  filter.assign(too_many.begin(), too_many.end()); // Repeated values.
+  EXPECT_EQ(1, filter.size());
+
+  std::vector<value_t> distinct(filter.capacity() + 1);
+  for (size_t i = 0; i != distinct.size(); ++i)
+    distinct[i] = i * 100;
+  EXPECT_THROW(filter.assign(distinct.begin(), distinct.end()),
+               quofil::filter_is_full);
+  EXPECT_TRUE(filter.empty());
+}
+
+FILTER_TEST(Can_be_built_in_parallel) {
+  using quofil::slot_layout;
+  for (const auto layout : {slot_layout::separate, slot_layout::blocked}) {
+    for (const unsigned num_threads : {1u, 3u, 8u}) {
+      SCOPED_TRACE(num_threads);
+      filter_t filter(12, 10, layout); // q_bits, r_bits
+      filter.insert(1234);
+
+      // A high load makes clusters cross the boundaries of the partitions
+      // and the end of the filter.
+      mt19937 gen(num_threads);
+      uniform_int_distribution<value_t> dist(0, (1 << 22) - 1);
+      std::vector<value_t> fps(3900);
+      for (auto &fp : fps)
+        fp = dist(gen);
+      for (value_t fp = (1 << 22) - 100; fp != (1 << 22); ++fp)
+        fps.push_back(fp);
+      fps.insert(fps.end(), fps.begin(), fps.begin() + 100); // Repeated.
+
+      const set_t expected(fps.begin(), fps.end());
+      filter.assign_parallel(fps, num_threads);
+      EXPECT_EQ(expected.size(), filter.size());
+      EXPECT_TRUE(equal(expected, filter));
+      for (const value_t fp : expected)
+        EXPECT_EQ(1, filter.count(fp));
+    }
+  }
+
+  filter_t filter(8, 8); // q_bits, r_bits
+  std::vector<value_t> distinct(filter.capacity() + 1);
+  for (size_t i = 0; i != distinct.size(); ++i)
+    distinct[i] = i * 100;
+  EXPECT_THROW(filter.assign_parallel(distinct, 4), quofil::filter_is_full);
+  EXPECT_TRUE(filter.empty());
+
+  filter_t empty_filter;
+  empty_filter.assign_parallel({}, 4);
+  EXPECT_TRUE(empty_filter.empty());
+}
+
+FILTER_TEST(Can_be_expanded) {
+  using quofil::slot_layout;
+  for (const auto layout : {slot_layout::separate, slot_layout::blocked}) {
+    filter_t filter(6, 10, layout); // q_bits, r_bits
+    populate(filter);
+    const set_t set(filter.begin(), filter.end());
+
+    filter.expand();
+    EXPECT_EQ(7, filter.quotient_bits());
+    EXPECT_EQ(9, filter.remainder_bits());
+    EXPECT_EQ(128, filter.capacity());
+    EXPECT_EQ(layout, filter.layout());
+    EXPECT_TRUE(equal(set, filter));
+
+    filter.expand();
+    EXPECT_TRUE(equal(set, filter));
+    for (const value_t fp : set)
+      EXPECT_EQ(1, filter.erase(fp));
+    EXPECT_TRUE(filter.empty());
+  }
+}
+
+// The slots are redistributed in place, so the result must be the same that
+// building the expanded filter from the sorted fingerprints, word by word.
+FILTER_TEST(Expands_like_a_sorted_build) {
+  using quofil::slot_layout;
+  const auto expect_expands = [](filter_t filter) {
+    filter_t expected(filter.quotient_bits() + 1, filter.remainder_bits() - 1,
+                      filter.layout());
+    expected.assign_sorted(filter.begin(), filter.end());
+    filter.expand();
+    std::ostringstream actual_os, expected_os;
+    filter.save(actual_os, 0);    // hash_tag
+    expected.save(expected_os, 0); // hash_tag
+    EXPECT_TRUE(totally_equal(expected, filter));
+    EXPECT_EQ(expected_os.str(), actual_os.str());
+  };
+
+  for (const auto layout : {slot_layout::separate, slot_layout::blocked}) {
+    for (const size_t q : {0, 1, 5, 6, 7, 9}) {
+      for (const size_t r : {2, 5, 9, 17}) {
+        filter_t full(q, r, layout);
+        populate(full);
+        expect_expands(full);
+
+        filter_t half(q, r, layout);
+        populate(half, half.capacity() / 2);
+        expect_expands(half);
+      }
+    }
+
+    // Every fingerprint belongs to the last quotients, so a cluster wraps
+    // around the end, and so do the quotients of some of its runs.
+    filter_t wrapped(7, 6, layout); // q_bits, r_bits
+    for (value_t fp = 120 << 6; !wrapped.full(); fp += 5)
+      wrapped.insert(fp % (128 << 6));
+    expect_expands(wrapped);
+    wrapped.erase(*wrapped.begin());
+    expect_expands(wrapped);
+  }
+}
+
+FILTER_TEST(Can_be_shrunk) {
+  filter_t filter(8, 6); // q_bits, r_bits
+  populate(filter, 100);
+  const set_t set(filter.begin(), filter.end());
+
+  filter.shrink();
+  EXPECT_EQ(7, filter.quotient_bits());
+  EXPECT_EQ(7, filter.remainder_bits());
+  EXPECT_TRUE(equal(set, filter));
+
+  // It has more than 32 elements.
+  EXPECT_THROW(filter.shrink(), quofil::filter_is_full);
+  EXPECT_TRUE(equal(set, filter));
+  EXPECT_EQ(128, filter.capacity());
+
+  for (const value_t fp : set)
+    EXPECT_EQ(1, filter.erase(fp));
+  while (filter.quotient_bits() != 0)
+    filter.shrink();
+  EXPECT_EQ(1, filter.capacity());
+  EXPECT_TRUE(filter.empty());
+}
+
+FILTER_TEST(Can_compute_the_union) {
+  filter_t lhs(8, 8);  // q_bits, r_bits
+  filter_t rhs(10, 6); // Same fingerprints, split in another way.
+  populate(lhs, 150);
+  populate(rhs, 600);
+  rhs.insert(*std::next(lhs.begin(), 10)); // A common fingerprint.
+
+  set_t expected(lhs.begin(), lhs.end());
+  expected.insert(rhs.begin(), rhs.end());
+
+  const filter_t result = union_of(lhs, rhs);
+  EXPECT_EQ(10, result.quotient_bits());
+  EXPECT_EQ(6, result.remainder_bits());
+  EXPECT_TRUE(equal(expected, result));
+
+  filter_t target(11, 5); // q_bits, r_bits
+  target.assign_union(lhs, rhs);
+  EXPECT_TRUE(equal(expected, target));
+  target.assign_union(target, filter_t{});
+  EXPECT_TRUE(equal(expected, target));
+  for (const value_t fp : expected)
+    EXPECT_TRUE(target.count(fp));
+
+  filter_t small(4, 12); // q_bits, r_bits
+  EXPECT_THROW(small.assign_union(lhs, rhs), quofil::filter_is_full);
+  EXPECT_TRUE(small.empty());
+  EXPECT_TRUE(equal(lhs, union_of(lhs, filter_t{})));
+}
+
+FILTER_TEST(Can_compute_the_intersection_and_the_difference) {
+  filter_t lhs(9, 7);  // q_bits, r_bits
+  filter_t rhs(12, 4); // Same fingerprints, split in another way.
+  populate(lhs, 400);
+  populate(rhs, 2000);
+  size_t i = 0;
+  for (const value_t fp : lhs)
+    if (i++ % 3 == 0)
+      rhs.insert(fp); // Common fingerprints.
+
+  set_t expected_intersection, expected_difference;
+  for (const value_t fp : lhs)
+    (rhs.count(fp) ? expected_intersection : expected_difference).insert(fp);
+  ASSERT_FALSE(expected_intersection.empty());
+
+  const filter_t intersection = intersection_of(lhs, rhs);
+  EXPECT_EQ(9, intersection.quotient_bits());
+  EXPECT_TRUE(equal(expected_intersection, intersection));
+
+  const filter_t difference = difference_of(lhs, rhs);
+  EXPECT_EQ(9, difference.quotient_bits());
+  EXPECT_TRUE(equal(expected_difference, difference));
+  EXPECT_TRUE(difference_of(lhs, lhs).empty());
+  EXPECT_TRUE(equal(lhs, difference_of(lhs, filter_t{})));
+  EXPECT_TRUE(intersection_of(lhs, filter_t{}).empty());
+
+  rhs.assign_intersection(rhs, lhs);
+  EXPECT_TRUE(equal(expected_intersection, rhs));
+  lhs.assign_difference(lhs, rhs);
+  EXPECT_TRUE(equal(expected_difference, lhs));
+}
+
 FILTER_TEST(Can_be_cleared) {
   filter_t filter(9, 6); // q_bits, r_bits
   populate(filter, filter.capacity());
@@ -196,8 +582,9 @@ FILTER_TEST(Can_be_cleared) {
   set_t set;
   while (!filter.full()) {
     const auto fp = gen_fp();
-    if (set.insert(fp).second)
+    if (set.insert(fp).second) {
       EXPECT_TRUE(filter.insert(fp).second);
+    }
   }
 
   for (value_t fp : set)
@@ -265,6 +652,164 @@ FILTER_TEST(Can_be_operated_normally_if_default_constructed) {
   EXPECT_TRUE(totally_equal(filter_t(), filter));
 }
 
+FILTER_TEST(Reports_its_memory_usage) {
+  const filter_t separate(10, 6); // q_bits, r_bits
+  const auto usage = separate.memory_usage();
+  EXPECT_EQ(16 * 4 * 8, usage.metadata); // 16 blocks of 4 words.
+  EXPECT_EQ(16 * 6 * 8, usage.remainders);
+  EXPECT_EQ(usage.metadata + usage.remainders + usage.slack, usage.total());
+  EXPECT_LT(usage.slack, 128);
+
+  // Each block takes two cache lines, 6 of its 16 words are padding. The
+  // storage ends with 4 more words, past the remainders of the last block.
+  const filter_t blocked(10, 6, quofil::slot_layout::blocked);
+  EXPECT_EQ(usage.metadata, blocked.memory_usage().metadata);
+  EXPECT_EQ(usage.remainders, blocked.memory_usage().remainders);
+  EXPECT_EQ(usage.slack + (16 * 6 + 4) * 8, blocked.memory_usage().slack);
+
+  EXPECT_EQ(0, filter_t().memory_usage().total());
+  EXPECT_EQ(0, separate.bits_per_element());
+
+  filter_t filter(10, 6); // q_bits, r_bits
+  populate(filter, 512);
+  EXPECT_DOUBLE_EQ(usage.total() * 8.0 / filter.size(),
+                   filter.bits_per_element());
+  EXPECT_GT(filter.bits_per_element(), 2 * (6 + 4));
+}
+
+FILTER_TEST(Reports_cluster_and_run_statistics) {
+  using counts_t = std::vector<size_t>;
+  EXPECT_EQ(0, filter_t(4, 4).statistics().cluster_lengths.total());
+
+  // Quotients 1, 1, 2, 5 and 6 give the clusters [1, 3], [5] and [6], and the
+  // spans [1, 3] and [5, 6].
+  filter_t filter(4, 4); // q_bits, r_bits
+  for (const value_t quotient : {1, 1, 2, 5, 6})
+    filter.insert(quotient << 4 | filter.size());
+  auto stats = filter.statistics();
+  EXPECT_EQ(counts_t({0, 2, 0, 1}), stats.cluster_lengths.counts);
+  EXPECT_EQ(counts_t({0, 3, 1}), stats.run_lengths.counts);
+  EXPECT_EQ(counts_t({3, 2}), stats.shift_distances.counts);
+  EXPECT_EQ(counts_t({0, 0, 1, 1}), stats.span_lengths.counts);
+  EXPECT_DOUBLE_EQ(0.4, stats.shift_distances.mean());
+  EXPECT_EQ(0, stats.shift_distances.percentile(0.6));
+  EXPECT_EQ(1, stats.shift_distances.percentile(0.61));
+  EXPECT_EQ(3, stats.cluster_lengths.max());
+
+  // The cluster of the quotient 15 wraps around.
+  filter.clear();
+  for (const value_t remainder : {1, 2, 3})
+    filter.insert(15 << 4 | remainder);
+  stats = filter.statistics();
+  EXPECT_EQ(counts_t({0, 0, 0, 1}), stats.cluster_lengths.counts);
+  EXPECT_EQ(counts_t({0, 0, 0, 1}), stats.span_lengths.counts);
+  EXPECT_EQ(counts_t({1, 1, 1}), stats.shift_distances.counts);
+
+  // Every slot is counted once, even if the filter is full.
+  const auto slots = [](const quofil::slot_histogram &histogram) {
+    size_t sum = 0;
+    for (size_t value = 0; value != histogram.counts.size(); ++value)
+      sum += value * histogram.counts[value];
+    return sum;
+  };
+  for (const auto layout :
+       {quofil::slot_layout::separate, quofil::slot_layout::blocked}) {
+    filter_t big(8, 8, layout); // q_bits, r_bits
+    populate(big);
+    ASSERT_TRUE(big.full());
+    stats = big.statistics();
+    EXPECT_EQ(big.size(), slots(stats.cluster_lengths));
+    EXPECT_EQ(big.size(), slots(stats.run_lengths));
+    EXPECT_EQ(big.size(), stats.shift_distances.total());
+    EXPECT_EQ(1, stats.span_lengths.total());
+    EXPECT_EQ(big.capacity(), stats.span_lengths.max());
+  }
+}
+
+FILTER_TEST(Can_be_saved_and_loaded) {
+  using quofil::slot_layout;
+  for (const auto layout : {slot_layout::separate, slot_layout::blocked}) {
+    filter_t filter(9, 7, layout); // q_bits, r_bits
+    populate(filter, filter.capacity() * 3 / 4);
+
+    std::stringstream stream;
+    filter.save(stream, 42); // hash_tag
+    const filter_t loaded = filter_t::load(stream, 42);
+    EXPECT_TRUE(totally_equal(filter, loaded));
+    EXPECT_EQ(layout, loaded.layout());
+    for (value_t fp : filter)
+      EXPECT_EQ(1, loaded.count(fp));
+  }
+
+  std::stringstream stream;
+  filter_t().save(stream, 42); // hash_tag
+  EXPECT_TRUE(totally_equal(filter_t(), filter_t::load(stream, 42)));
+}
+
+FILTER_TEST(Can_be_viewed_from_a_buffer) {
+  filter_t filter(10, 6); // q_bits, r_bits
+  populate(filter, 700);
+
+  std::ostringstream stream;
+  filter.save(stream, 3); // hash_tag
+  const std::string bytes = stream.str();
+  std::vector<value_t> buffer(bytes.size() / sizeof(value_t) + 1);
+  std::memcpy(buffer.data(), bytes.data(), bytes.size());
+  const std::vector<value_t> read_only = buffer;
+
+  const auto view = filter_t::view_from_buffer(buffer.data(), bytes.size(), 3);
+  EXPECT_TRUE(totally_equal(filter, view.filter()));
+  EXPECT_EQ(filter.size(), view.size());
+
+  // The view reads the buffer, but its copies do not.
+  const value_t fp = *filter.begin();
+  filter_t copy = view.filter();
+  std::fill(buffer.begin() + 8, buffer.end(), 0); // Past the header.
+  EXPECT_EQ(0, view.count(fp));
+  EXPECT_EQ(1, copy.count(fp));
+  EXPECT_TRUE(totally_equal(filter, copy));
+
+  const auto const_view =
+      filter_t::view_from_buffer(read_only.data(), bytes.size(), 3);
+  EXPECT_TRUE(totally_equal(filter, const_view.filter()));
+  EXPECT_TRUE(std::equal(filter.begin(), filter.end(), const_view.begin()));
+}
+
+FILTER_TEST(Rejects_malformed_data) {
+  filter_t filter(8, 8); // q_bits, r_bits
+  populate(filter, 100);
+  std::ostringstream stream;
+  filter.save(stream, 7); // hash_tag
+  const std::string bytes = stream.str();
+
+  const auto load = [](std::string data, std::uint64_t hash_tag) {
+    std::istringstream is(data);
+    return filter_t::load(is, hash_tag);
+  };
+  EXPECT_NO_THROW(load(bytes, 7));
+  EXPECT_THROW(load(bytes, 8), quofil::bad_filter_format);
+  EXPECT_THROW(load(bytes.substr(0, 40), 7), quofil::bad_filter_format);
+  EXPECT_THROW(load(bytes.substr(0, bytes.size() - 1), 7),
+               quofil::bad_filter_format);
+  EXPECT_THROW(load("QUOFILFX" + bytes.substr(8), 7),
+               quofil::bad_filter_format);
+
+  // A header claiming a huge filter must not allocate it up front.
+  std::string huge = bytes;
+  const std::uint64_t q_bits = 40;
+  const std::uint64_t num_words = (4 + 8) * (std::uint64_t{1} << (40 - 6));
+  std::memcpy(&huge[24], &q_bits, sizeof(q_bits));      // quotient_bits
+  std::memcpy(&huge[48], &num_words, sizeof(num_words)); // num_words
+  EXPECT_THROW(load(huge, 7), quofil::bad_filter_format);
+
+  std::vector<value_t> buffer(bytes.size() / sizeof(value_t));
+  std::memcpy(buffer.data(), bytes.data(), bytes.size());
+  EXPECT_THROW(filter_t::view_from_buffer(buffer.data(), bytes.size() - 8, 7),
+               quofil::bad_filter_format);
+  EXPECT_THROW(filter_t::view_from_buffer(buffer.data(), 63, 7),
+               quofil::bad_filter_format);
+}
+
 // ==========================================
 // ITERATOR_TEST Section
 // ==========================================
@@ -291,3 +836,13 @@ ITERATOR_TEST(Works_as_expected_when_constructed) {
   filter.insert(value2);
   EXPECT_EQ(value2, *filter.begin());
 }
+
+ITERATOR_TEST(Can_iterate_over_sparse_filters) {
+  filter_t filter(16, 4); // q_bits, r_bits
+  const set_t set = {0x00003, 0x0fff1, 0x10000, 0x7abcd, 0xfffff};
+  for (const value_t fp : set)
+    filter.insert(fp);
+
+  EXPECT_TRUE(equal(filter, set));
+  EXPECT_EQ(filter.end(), std::next(filter.find(0xfffff)));
+}
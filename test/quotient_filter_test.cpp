@@ -6,13 +6,19 @@
 #include <quofil/quotient_filter.hpp>
 #include <gtest/gtest.h>
 
+#include <algorithm>   // for std::{all_of, equal, sort, transform}
 #include <iterator>    //
 #include <ostream>     // for std::ostream
+#include <sstream>     // for std::{stringstream, ostringstream}
 #include <stdexcept>   // for std::length_error
+#include <string>      // for std::string
 #include <type_traits> // for concepts check section
 #include <utility>     //
+#include <vector>      // for std::vector
 #include <cassert>     // for assert
 #include <cstddef>     //
+#include <cstdint>     // for std::uint64_t
+#include <cstring>     // for std::memcpy
 // See below the use of uncommented headers.
 
 // ==========================================
@@ -92,6 +98,12 @@ public:
 
 } // End anonymous namespace
 
+namespace quofil {
+// Lets the filters using test_hash be stored.
+template <>
+struct hash_tag<test_hash> : std::integral_constant<std::uint64_t, 0x7e57> {};
+} // end namespace quofil
+
 // ==========================================
 // Type aliases
 // ==========================================
@@ -168,8 +180,8 @@ static void expect_empty(const filter_t &c) {
 
 // Checks whether a non-empty filter has the given contents and checks
 // invariants.
-template <typename T, typename H, size_t B>
-static void expect_contents(const quotient_filter<T, H, B> &c,
+template <typename T, typename H, size_t B, quofil::slot_layout L>
+static void expect_contents(const quotient_filter<T, H, B, L> &c,
                             const initializer_list<size_t> hash_list) {
   ASSERT_TRUE(hash_list.size() > 0) << "For empty filters use expect_empty()";
 
@@ -521,6 +533,34 @@ TEST(FilterTest, Count) {
   EXPECT_EQ(0, c.count(60));
 }
 
+TEST(FilterTest, CountMany) {
+  const filter_t c = {10, 20, 30, 40, 50};
+  const std::vector<int> keys = {0, 10, 35, 50, 10, 60, 40};
+  std::vector<size_t> counts;
+  c.count_many(keys.begin(), keys.end(), std::back_inserter(counts));
+  EXPECT_EQ((std::vector<size_t>{0, 1, 0, 1, 1, 0, 1}), counts);
+
+  std::vector<size_t> hashes(keys.size());
+  std::transform(keys.begin(), keys.end(), hashes.begin(), c.hash_function());
+  std::vector<bool> bitmap(keys.size());
+  c.count_many_hashed(hashes.begin(), hashes.end(), bitmap.begin());
+  EXPECT_TRUE(std::equal(counts.begin(), counts.end(), bitmap.begin()));
+}
+
+TEST(FilterTest, FindMany) {
+  const filter_t c = {10, 20, 30, 40, 50};
+  const std::vector<int> keys(600, 30); // More keys than a batch.
+  std::vector<filter_t::const_iterator> found(keys.size());
+  EXPECT_EQ(found.end(), c.find_many(keys.begin(), keys.end(), found.begin()));
+  for (const auto it : found)
+    EXPECT_TRUE(it == std::next(c.begin(), 2));
+
+  const std::vector<size_t> hashes = {35, 50};
+  c.find_many_hashed(hashes.begin(), hashes.end(), found.begin());
+  EXPECT_TRUE(found[0] == c.end());
+  EXPECT_EQ(50, *found[1]);
+}
+
 TEST(FilterTest, LoadFactor) {
   filter_t c;
   c.insert(10);
@@ -582,6 +622,43 @@ TEST(FilterTest, Regenerate) {
   expect_contents(c, {1, 2, 3, 4});
 }
 
+TEST(FilterTest, RegenerateKeepsContents) {
+  filter_t c;
+  std::vector<size_t> expected;
+  for (int key = 0; key < 3000; key += 7) {
+    c.insert(key * 13 % 65536); // Grows several times.
+    expected.push_back(size_t(key * 13 % 65536));
+  }
+  std::sort(expected.begin(), expected.end());
+  EXPECT_TRUE(std::equal(expected.begin(), expected.end(), c.begin(), c.end()));
+
+  c.regenerate(8 * c.slot_count());
+  EXPECT_TRUE(std::equal(expected.begin(), expected.end(), c.begin(), c.end()));
+  c.regenerate(0);
+  EXPECT_TRUE(std::equal(expected.begin(), expected.end(), c.begin(), c.end()));
+}
+
+TEST(FilterTest, ShrinkToFit) {
+  filter_t c;
+  for (int key = 0; key < 1000; ++key)
+    c.insert(key);
+  const auto peak_slot_count = c.slot_count();
+
+  for (int key = 10; key < 1000; ++key)
+    c.erase(key);
+  EXPECT_EQ(peak_slot_count, c.slot_count());
+
+  c.shrink_to_fit();
+  expect_properties(c, sc_exactly(16), test_hash{}, default_max_load_factor);
+  expect_contents(c, {0, 1, 2, 3, 4, 5, 6, 7, 8, 9});
+
+  for (int key = 6; key < 10; ++key)
+    c.erase(key);
+  c.shrink_to_fit(); // A single halving.
+  expect_properties(c, sc_exactly(8), test_hash{}, default_max_load_factor);
+  expect_contents(c, {0, 1, 2, 3, 4, 5});
+}
+
 TEST(FilterTest, Reserve) {
   filter_t c;
   c.max_load_factor(0.5f);
@@ -635,6 +712,152 @@ TEST(FilterTest, EqualityOperators) {
   }
 }
 
+TEST(FilterTest, Merge) {
+  filter_t c = {1, 3, 5, 7};
+  const filter_t other = {2, 3, 4, 100, 1000};
+  c.merge(other);
+  expect_contents(c, {1, 2, 3, 4, 5, 7, 100, 1000});
+
+  c.merge(c);
+  expect_contents(c, {1, 2, 3, 4, 5, 7, 100, 1000});
+
+  filter_t empty;
+  empty.merge(other);
+  expect_contents(empty, {2, 3, 4, 100, 1000});
+}
+
+TEST(FilterTest, UnionOf) {
+  filter_t lhs(0, test_hash{2});
+  lhs.max_load_factor(0.5f);
+  lhs.insert({10, 20, 30});
+  const filter_t rhs = {20, 40};
+
+  const filter_t result = union_of(lhs, rhs);
+  expect_properties(result, sc_at_least(10), test_hash{2}, 0.5f);
+  expect_contents(result, {10, 20, 30, 40});
+  expect_contents(union_of(filter_t{}, rhs), {20, 40});
+  expect_empty(union_of(filter_t{}, filter_t{}));
+}
+
+TEST(FilterTest, Intersect) {
+  filter_t c = {1, 3, 5, 7, 9};
+  c.intersect(filter_t{3, 4, 7, 8, 9, 11});
+  expect_contents(c, {3, 7, 9});
+  c.intersect(filter_t{});
+  expect_empty(c);
+}
+
+TEST(FilterTest, Subtract) {
+  filter_t c = {1, 3, 5, 7, 9};
+  c.subtract(filter_t{3, 4, 7, 8});
+  expect_contents(c, {1, 5, 9});
+  c.subtract(c);
+  expect_empty(c);
+}
+
+TEST(FilterTest, IntersectionAndDifferenceOf) {
+  filter_t lhs(0, test_hash{3});
+  lhs.insert({10, 20, 30, 40});
+  const filter_t rhs = {20, 40, 50};
+
+  const filter_t intersection = intersection_of(lhs, rhs);
+  expect_properties(intersection, sc_exactly(4), test_hash{3},
+                    default_max_load_factor);
+  expect_contents(intersection, {20, 40});
+
+  const filter_t difference = difference_of(lhs, rhs);
+  expect_properties(difference, sc_exactly(8), test_hash{3},
+                    default_max_load_factor);
+  expect_contents(difference, {10, 30});
+  expect_contents(difference_of(lhs, filter_t{}), {10, 20, 30, 40});
+  expect_empty(intersection_of(filter_t{}, rhs));
+}
+
+TEST(FilterTest, AssignParallel) {
+  filter_t c = {1, 2};
+  const std::vector<int> keys = {5, 3, 9, 3, 1, 7, 5};
+  c.assign_parallel(keys.begin(), keys.end(), 3);
+  expect_contents(c, {1, 3, 5, 7, 9});
+
+  std::vector<int> many(5000);
+  for (size_t i = 0; i != many.size(); ++i)
+    many[i] = static_cast<int>(i * 7);
+  c.assign_parallel(many.begin(), many.end(), 4);
+  EXPECT_EQ(many.size(), c.size());
+  EXPECT_LE(c.size(), c.max_load_factor() * c.slot_count());
+  EXPECT_TRUE(std::all_of(many.begin(), many.end(),
+                          [&](int key) { return c.count(key) == 1; }));
+
+  c.assign_parallel(many.begin(), many.begin(), 2);
+  expect_empty(c);
+}
+
+TEST(FilterTest, SaveAndLoad) {
+  filter_t c({1, 2, 3, 4, 5}, 100, test_hash{23});
+  std::stringstream stream;
+  c.save(stream);
+
+  const filter_t loaded = filter_t::load(stream, test_hash{23});
+  expect_properties(loaded, sc_exactly(c.slot_count()), test_hash{23},
+                    default_max_load_factor);
+  expect_contents(loaded, {1, 2, 3, 4, 5});
+  EXPECT_TRUE(c == loaded);
+
+  // A filter stored with a higher load factor keeps it.
+  c.max_load_factor(1.0f);
+  c.insert({6, 7, 8, 9, 10, 11, 12, 13});
+  c.shrink_to_fit();
+  ASSERT_EQ(16, c.slot_count());
+  stream.str("");
+  c.save(stream);
+  filter_t full = filter_t::load(stream);
+  EXPECT_TRUE(c == full);
+  EXPECT_GT(full.max_load_factor(), default_max_load_factor);
+  full.insert(14);
+  expect_contents(full, {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14});
+
+  stream.str("");
+  quotient_filter<int, test_hash, 20>({1, 2}).save(stream);
+  EXPECT_THROW(filter_t::load(stream), quofil::bad_filter_format);
+}
+
+TEST(FilterTest, ViewFromBuffer) {
+  const filter_t c = {3, 1, 4, 1, 5, 9, 2, 6};
+  std::ostringstream stream;
+  c.save(stream);
+  const std::string bytes = stream.str();
+  std::vector<size_t> buffer(bytes.size() / sizeof(size_t));
+  std::memcpy(buffer.data(), bytes.data(), bytes.size());
+
+  const auto view = filter_t::view_from_buffer(buffer.data(), bytes.size());
+  expect_contents(view.filter(), {1, 2, 3, 4, 5, 6, 9});
+  EXPECT_EQ(1, view.count(9));
+  EXPECT_EQ(0, view.count(7));
+
+  filter_t copy = view.filter();
+  copy.insert(7);
+  expect_contents(view.filter(), {1, 2, 3, 4, 5, 6, 9});
+}
+
+TEST(FilterTest, MemoryUsage) {
+  filter_t c(1024);
+  EXPECT_EQ(0, c.bits_per_element());
+  // 16 bits of hash values, so 6 bits for the remainders.
+  EXPECT_EQ(16 * (4 + 6) * 8, c.memory_usage().metadata +
+                                  c.memory_usage().remainders);
+  c.insert({1, 2, 3, 4});
+  EXPECT_DOUBLE_EQ(c.memory_usage().total() * 8.0 / 4, c.bits_per_element());
+}
+
+TEST(FilterTest, Statistics) {
+  filter_t c(1024);
+  c.insert({1, 2, 3, 4});
+  const auto stats = c.statistics();
+  EXPECT_EQ(4, stats.shift_distances.total());
+  EXPECT_LE(stats.span_lengths.total(), stats.cluster_lengths.total());
+  EXPECT_LE(stats.cluster_lengths.total(), stats.run_lengths.total());
+}
+
 TEST(FilterTest, SwapMember) {
   filter_t c1({1, 2, 3, 4, 5}, 250, test_hash{23});
   c1.max_load_factor(0.3f);
@@ -670,3 +893,56 @@ TEST(FilterTest, SwapNonMember) {
   expect_properties(c2, sc_exactly(c1_sc), test_hash{23}, 0.3f);
   expect_contents(c2, {1, 2, 3, 4, 5});
 }
+
+TEST(FilterTest, BlockedLayout) {
+  using blocked_filter_t =
+      quotient_filter<int, test_hash, 16, quofil::slot_layout::blocked>;
+  STATIC_ASSERT(blocked_filter_t::layout == quofil::slot_layout::blocked);
+  STATIC_ASSERT(filter_t::layout == quofil::slot_layout::separate);
+
+  blocked_filter_t c = {5, 1, 3, 5, 2, 4, 3};
+  c.reserve(100);
+  expect_contents(c, {1, 2, 3, 4, 5});
+  EXPECT_EQ(1, c.count(4));
+  EXPECT_EQ(1, c.erase(4));
+  expect_contents(c, {1, 2, 3, 5});
+}
+
+// With 128 slots of 16 bits hash values, the quotient takes the upper 7 bits
+// and each remainder 9 bits, so remainders straddle words. The runs of the
+// quotients 60 and 62 are moved across the boundary between the first and the
+// second block, and the cluster of the quotient 126 wraps around the end.
+template <quofil::slot_layout Layout>
+static void test_slot_moves_across_blocks() {
+  using layout_filter_t = quotient_filter<int, test_hash, 16, Layout>;
+  constexpr size_t a = 60 << 9, b = 62 << 9, c = 126 << 9, d = 1 << 9;
+
+  layout_filter_t f(128);
+  ASSERT_EQ(128, f.slot_count());
+  f.insert({a + 0, a + 1, a + 2, a + 3, a + 4, a + 5});
+  f.insert({b + 0, b + 1, b + 2, b + 3});
+  f.insert(a + 6);
+  f.insert({c + 0, c + 1, c + 2, c + 3, 1, d});
+  f.insert(c + 4);
+  expect_contents(f, {1, d, a + 0, a + 1, a + 2, a + 3, a + 4, a + 5, a + 6,
+                      b + 0, b + 1, b + 2, b + 3, c + 0, c + 1, c + 2, c + 3,
+                      c + 4});
+
+  EXPECT_EQ(1, f.erase(a + 0));
+  EXPECT_EQ(1, f.erase(a + 3));
+  EXPECT_EQ(1, f.erase(c + 0));
+  EXPECT_EQ(1, f.erase(1));
+  expect_contents(f, {d, a + 1, a + 2, a + 4, a + 5, a + 6, b + 0, b + 1,
+                      b + 2, b + 3, c + 1, c + 2, c + 3, c + 4});
+
+  for (const size_t key : {a + 1, a + 2, a + 4, a + 5, a + 6, c + 1, c + 2})
+    EXPECT_EQ(1, f.erase(static_cast<int>(key)));
+  expect_contents(f, {d, b + 0, b + 1, b + 2, b + 3, c + 3, c + 4});
+  EXPECT_EQ(1, f.count(b + 3));
+  EXPECT_EQ(0, f.count(a + 6));
+}
+
+TEST(FilterTest, SlotMovesAcrossBlocks) {
+  test_slot_moves_across_blocks<quofil::slot_layout::separate>();
+  test_slot_moves_across_blocks<quofil::slot_layout::blocked>();
+}
@@ -0,0 +1,160 @@
+//          Copyright Diego Ramírez June 2015
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <quofil/sharded_quotient_filter.hpp>
+#include <gtest/gtest.h>
+
+#include <algorithm> // for std::equal
+#include <set>       // for std::set
+#include <thread>    // for std::thread
+#include <vector>    // for std::vector
+#include <cstddef>   // for std::size_t, std::max_align_t
+#include <cstdint>   // for std::uint64_t
+
+// ==========================================
+// Hash function used for testing.
+// ==========================================
+
+namespace {
+// Spreads the keys over the whole 32 bits, so they reach every shard.
+struct test_hash {
+  std::size_t operator()(const unsigned key) const noexcept {
+    return static_cast<unsigned>(key * 2654435761u);
+  }
+};
+} // End anonymous namespace
+
+// ==========================================
+// Type aliases
+// ==========================================
+
+using filter_t = quofil::sharded_quotient_filter<unsigned, test_hash, 8, 32>;
+
+// ==========================================
+// Tests section
+// ==========================================
+
+TEST(ShardedFilterTest, Properties) {
+  static_assert(filter_t::shard_count == 8, "");
+  static_assert(filter_t::shard_bits == 3, "");
+  static_assert(filter_t::shard_type::hash_bits == 29, "");
+  static_assert(alignof(filter_t) <= alignof(std::max_align_t),
+                "The shards must be aligned even if operator new allocates "
+                "the filter");
+  static_assert(quofil::sharded_quotient_filter<int, test_hash, 1>::
+                        shard_bits == 0,
+                "");
+
+  const filter_t c(100);
+  EXPECT_TRUE(c.empty());
+  EXPECT_EQ(0, c.size());
+  EXPECT_LE(100, c.slot_count());
+  EXPECT_FLOAT_EQ(0.0f, c.load_factor());
+}
+
+TEST(ShardedFilterTest, InsertEraseAndCount) {
+  filter_t c;
+  EXPECT_TRUE(c.insert(10));
+  EXPECT_TRUE(c.insert(20));
+  EXPECT_FALSE(c.insert(10));
+  EXPECT_EQ(2, c.size());
+  EXPECT_EQ(1, c.count(10));
+  EXPECT_EQ(0, c.count(30));
+
+  EXPECT_EQ(1, c.erase(10));
+  EXPECT_EQ(0, c.erase(10));
+  EXPECT_EQ(0, c.count(10));
+  EXPECT_EQ(1, c.size());
+
+  c.clear();
+  EXPECT_TRUE(c.empty());
+}
+
+TEST(ShardedFilterTest, ForEachVisitsHashValuesInOrder) {
+  filter_t c;
+  std::set<std::size_t> expected;
+  for (unsigned key = 0; key != 1000; ++key) {
+    c.insert(key);
+    expected.insert(test_hash{}(key));
+  }
+  EXPECT_EQ(expected.size(), c.size());
+  EXPECT_LE(c.load_factor(), c.max_load_factor());
+
+  std::vector<std::size_t> visited;
+  c.for_each([&](std::size_t hash_value) { visited.push_back(hash_value); });
+  EXPECT_TRUE(std::equal(expected.begin(), expected.end(), visited.begin(),
+                         visited.end()));
+}
+
+// std::hash returns all the 64 bits of the keys, but only the lowest 32 bits
+// are used.
+TEST(ShardedFilterTest, IgnoresTheHighBitsOfWideHashValues) {
+  struct wide_hash {
+    std::size_t operator()(const std::uint64_t key) const noexcept {
+      return static_cast<std::size_t>(key);
+    }
+  };
+  quofil::sharded_quotient_filter<std::uint64_t, wide_hash, 8, 32> c;
+  const std::uint64_t high = std::uint64_t{0xffffffff} << 32;
+  for (std::uint64_t key = 0; key != 8; ++key) {
+    const std::uint64_t wide_key = high | key << 29 | key;
+    EXPECT_TRUE(c.insert(wide_key));
+    EXPECT_EQ(1, c.count(wide_key));
+    EXPECT_EQ(1, c.count(key << 29 | key));
+  }
+  EXPECT_EQ(8, c.size());
+
+  std::vector<std::size_t> visited;
+  c.for_each([&](std::size_t hash_value) { visited.push_back(hash_value); });
+  ASSERT_EQ(8, visited.size());
+  for (std::size_t key = 0; key != 8; ++key)
+    EXPECT_EQ(key << 29 | key, visited[key]);
+
+  EXPECT_EQ(1, c.erase(high | 3 << 29 | 3));
+  EXPECT_EQ(7, c.size());
+}
+
+TEST(ShardedFilterTest, MaxLoadFactorAndReserve) {
+  filter_t c;
+  c.max_load_factor(0.5f);
+  EXPECT_FLOAT_EQ(0.5f, c.max_load_factor());
+  c.reserve(800);
+  EXPECT_LE(1600, c.slot_count());
+  const auto slot_count = c.slot_count();
+  for (unsigned key = 0; key != 400; ++key)
+    c.insert(key);
+  EXPECT_GE(c.slot_count(), slot_count);
+  EXPECT_LE(c.load_factor(), 0.5f);
+}
+
+TEST(ShardedFilterTest, ConcurrentInsertions) {
+  filter_t c;
+  constexpr unsigned num_threads = 4;
+  constexpr unsigned keys_per_thread = 5000;
+
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t != num_threads; ++t) {
+    threads.emplace_back([&c, t] {
+      for (unsigned i = 0; i != keys_per_thread; ++i) {
+        const unsigned key = i * num_threads + t;
+        c.insert(key);
+        if (i % 3 == 0)
+          c.erase(key);
+        else
+          EXPECT_EQ(1, c.count(key));
+      }
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+
+  size_t expected_size = 0;
+  for (unsigned key = 0; key != num_threads * keys_per_thread; ++key) {
+    const bool present = (key / num_threads) % 3 != 0;
+    EXPECT_EQ(present, c.count(key) == 1) << key;
+    expected_size += present;
+  }
+  EXPECT_EQ(expected_size, c.size());
+}